@@ -0,0 +1,107 @@
+#include <buffer_pool.h>
+
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+
+namespace Oceanus {
+
+BufferPool::BufferPool(initializer_list<size_t> class_sizes, unsigned max_cached)
+  : _max_cached(max_cached),
+    _heap_allocations(0)
+{
+  for (auto size : class_sizes) {
+    _classes.push_back({ max(size, sizeof(FreeBlock)), nullptr, 0 });
+  }
+  sort(_classes.begin(), _classes.end(), [](const SizeClass& a, const SizeClass& b) { return a.size < b.size; });
+}
+
+BufferPool::~BufferPool()
+{
+  for (auto& size_class : _classes) {
+    while (size_class.free) {
+      FreeBlock* block = size_class.free;
+      size_class.free = block->next;
+      ::operator delete(block);
+    }
+  }
+}
+
+unsigned
+BufferPool::size_class(size_t size) const
+{
+  unsigned i = 0;
+  while (i < _classes.size() && _classes[i].size < size) {
+    i++;
+  }
+  return i;
+}
+
+void*
+BufferPool::allocate(size_t size, uint8_t& size_class)
+{
+  unsigned i = this->size_class(size);
+  if (i == _classes.size()) {
+    throw length_error("Requested block size exceeds largest pool size class");
+  }
+  size_class = i;
+
+  {
+    lock_guard<mutex> lock(_mutex);
+    FreeBlock* block = _classes[i].free;
+    if (block) {
+      _classes[i].free = block->next;
+      _classes[i].cached--;
+      return block;
+    }
+    _heap_allocations++;
+  }
+  return ::operator new(_classes[i].size);
+}
+
+void
+BufferPool::release(void* block, uint8_t size_class)
+{
+  {
+    lock_guard<mutex> lock(_mutex);
+    SizeClass& pool = _classes[size_class];
+    if (pool.cached < _max_cached) {
+      FreeBlock* free_block = static_cast<FreeBlock*>(block);
+      free_block->next = pool.free;
+      pool.free = free_block;
+      pool.cached++;
+      return;
+    }
+  }
+  ::operator delete(block);
+}
+
+void*
+BufferPool::allocate(size_t size)
+{
+  if (size_class(size) == _classes.size()) {
+    return ::operator new(size);
+  }
+  uint8_t size_class;
+  return allocate(size, size_class);
+}
+
+void
+BufferPool::release(void* block, size_t size)
+{
+  unsigned i = size_class(size);
+  if (i == _classes.size()) {
+    ::operator delete(block);
+    return;
+  }
+  release(block, (uint8_t) i);
+}
+
+uint64_t
+BufferPool::heap_allocations() const
+{
+  lock_guard<mutex> lock(_mutex);
+  return _heap_allocations;
+}
+
+};
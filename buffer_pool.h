@@ -0,0 +1,90 @@
+// -*- C++ -*-
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+namespace Oceanus {
+
+// Pool of memory blocks in a few size classes.  Released blocks are
+// kept on a free list per size class and handed out again, so that a
+// steady state workload does not allocate from the heap.  Blocks may
+// be released from any thread.
+
+class BufferPool
+{
+public:
+  BufferPool(initializer_list<size_t> class_sizes, unsigned max_cached);
+  ~BufferPool();
+
+  BufferPool(const BufferPool&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+
+  // Allocate a block of at least size bytes.  The size class must be
+  // passed back to release().
+  void* allocate(size_t size, uint8_t& size_class);
+  void release(void* block, uint8_t size_class);
+
+  // For callers that know the size when releasing.  Blocks larger than
+  // the largest size class come straight from the heap.
+  void* allocate(size_t size);
+  void release(void* block, size_t size);
+
+  size_t class_size(uint8_t size_class) const { return _classes[size_class].size; }
+
+  // Number of blocks that had to be allocated from the heap
+  uint64_t heap_allocations() const;
+
+private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  struct SizeClass {
+    size_t size;
+    FreeBlock* free;
+    unsigned cached;
+  };
+
+  const unsigned _max_cached;
+
+  mutable mutex _mutex;
+  vector<SizeClass> _classes;
+  uint64_t _heap_allocations;
+
+  unsigned size_class(size_t size) const;
+};
+
+// Standard allocator handing out blocks of a BufferPool, for
+// allocate_shared() and promises
+template <class T>
+class PoolAllocator
+{
+public:
+  using value_type = T;
+
+  PoolAllocator(BufferPool& pool) : _pool(&pool) {}
+  template <class U>
+  PoolAllocator(const PoolAllocator<U>& other) : _pool(other.pool()) {}
+
+  T* allocate(size_t n) { return static_cast<T*>(_pool->allocate(n * sizeof(T))); }
+  void deallocate(T* block, size_t n) { _pool->release(block, n * sizeof(T)); }
+
+  BufferPool* pool() const { return _pool; }
+
+private:
+  BufferPool* _pool;
+};
+
+template <class T, class U>
+bool operator==(const PoolAllocator<T>& a, const PoolAllocator<U>& b) { return a.pool() == b.pool(); }
+template <class T, class U>
+bool operator!=(const PoolAllocator<T>& a, const PoolAllocator<U>& b) { return a.pool() != b.pool(); }
+
+};
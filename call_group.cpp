@@ -0,0 +1,77 @@
+#include <call_group.h>
+
+namespace Oceanus {
+
+CallGroup::CallGroup(Radio& radio)
+  : _radio(radio),
+    _epoch(0)
+{
+}
+
+CallGroup::~CallGroup()
+{
+  cancel();
+}
+
+void
+CallGroup::submit(const Radio::Command& command, Radio::response_handler handler, Radio::Priority priority)
+{
+  auto epoch = _epoch;
+  auto id = make_shared<Radio::call_id>(0);
+  auto finished = make_shared<bool>(false);
+  auto call = _radio.submit(command, [this, epoch, id, finished, handler](response_ptr response, exception_ptr error) {
+    *finished = true;
+    if (epoch != _epoch) {
+      return;
+    }
+    _calls.erase(*id);
+    handler(move(response), error);
+  }, Radio::no_deadline, priority);
+  // The call may have failed synchronously
+  if (!*finished) {
+    *id = call;
+    _calls.insert(call);
+  }
+}
+
+void
+CallGroup::submit_batch(const vector<pair<Radio::Command, decoder>>& calls, batch_handler done,
+                        Radio::Priority priority)
+{
+  struct Pending {
+    size_t remaining;
+    bool failed = false;
+  };
+  auto pending = make_shared<Pending>();
+  pending->remaining = calls.size();
+
+  for (auto& [command, decode] : calls) {
+    submit(command, [pending, decode = decode, done](response_ptr response, exception_ptr error) {
+      try {
+        if (error) {
+          rethrow_exception(error);
+        }
+        decode(*response);
+      }
+      catch (exception&) {
+        pending->failed = true;
+      }
+      if (!--pending->remaining) {
+        done(!pending->failed);
+      }
+    }, priority);
+  }
+}
+
+void
+CallGroup::cancel()
+{
+  _epoch++;
+  auto calls = move(_calls);
+  _calls.clear();
+  for (auto id : calls) {
+    _radio.cancel(id);
+  }
+}
+
+};
@@ -0,0 +1,57 @@
+// -*- C++ -*-
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include <oceanus.h>
+
+using namespace std;
+
+namespace Oceanus {
+
+// The calls a component has outstanding with the radio.  cancel()
+// cancels them and drops the responses to all calls submitted before,
+// so that handlers never see responses that belong to state the
+// component has since thrown away.  Outstanding calls are cancelled
+// on destruction.
+//
+// Reactor thread only.
+
+class CallGroup
+{
+public:
+  using decoder = function<void(const Response& response)>;
+  using batch_handler = function<void(bool succeeded)>;
+
+  CallGroup(Radio& radio);
+  ~CallGroup();
+
+  CallGroup(const CallGroup&) = delete;
+  CallGroup& operator=(const CallGroup&) = delete;
+
+  void submit(const Radio::Command& command, Radio::response_handler handler,
+              Radio::Priority priority = Radio::INTERACTIVE);
+
+  // Calls whose results only count together.  Each response is passed
+  // to its decoder, and once all calls have completed, done is invoked
+  // with false if any of them failed or could not be decoded.
+  void submit_batch(const vector<pair<Radio::Command, decoder>>& calls, batch_handler done,
+                    Radio::Priority priority = Radio::INTERACTIVE);
+
+  void cancel();
+
+  // Outstanding calls
+  size_t size() const { return _calls.size(); }
+
+private:
+  Radio& _radio;
+  uint64_t _epoch;                  // incremented by cancel() to drop stale responses
+  set<Radio::call_id> _calls;
+};
+
+};
@@ -0,0 +1,280 @@
+// -*- C++ -*-
+
+#pragma once
+
+#include <array>
+#include <string_view>
+#include <tuple>
+#include <utility>
+
+#include <oceanus.h>
+#include <magic_enum.hpp>
+
+using namespace std;
+
+namespace Oceanus {
+
+// Command names, looked up in tables that are built at compile time
+
+template <class E>
+constexpr array<string_view, 256>
+make_command_names()
+{
+  array<string_view, 256> names{};
+  for (auto& entry : magic_enum::enum_entries<E>()) {
+    names[entry.first] = entry.second;
+  }
+  return names;
+}
+
+inline constexpr auto system_names = make_command_names<SYSTEM_Command>();
+inline constexpr auto stream_names = make_command_names<STREAM_Command>();
+inline constexpr auto rtc_names = make_command_names<RTC_Command>();
+inline constexpr auto mot_names = make_command_names<MOT_Command>();
+inline constexpr auto slave_names = make_command_names<SLAVE_Command>();
+inline constexpr auto gpio_names = make_command_names<GPIO_Command>();
+
+constexpr string_view
+command_name(uint8_t command_type, uint8_t command)
+{
+  string_view name;
+  switch (command_type) {
+  case SYSTEM:
+    name = system_names[command];
+    break;
+  case STREAM:
+    name = stream_names[command];
+    break;
+  case RTC:
+    name = rtc_names[command];
+    break;
+  case MOT:
+    name = mot_names[command];
+    break;
+  case NOTIFICATION:
+    name = slave_names[command];
+    break;
+  case GPIO:
+    name = gpio_names[command];
+    break;
+  default:
+    return "Unknown command type";
+  }
+  return name.empty() ? "Unknown command" : name;
+}
+
+// The module answered a command with an error response
+class command_error
+  : public runtime_error
+{
+public:
+  command_error(string_view command, uint8_t error_code)
+    : runtime_error(string(command) + " failed, error code " + to_string(error_code)),
+      _error_code(error_code)
+  {}
+
+  uint8_t error_code() const { return _error_code; }
+
+private:
+  uint8_t _error_code;
+};
+
+// Field codecs for command arguments and response payloads.  Variable
+// length fields consume the rest of the payload and must come last.
+
+namespace Field {
+
+struct u8
+{
+  using type = uint8_t;
+  static const unsigned size = 1;
+  static void encode(Arguments& arguments, type value) { arguments.u8(value); }
+  static type decode(const uint8_t* p, unsigned) { return p[0]; }
+};
+
+struct u16
+{
+  using type = uint16_t;
+  static const unsigned size = 2;
+  static void encode(Arguments& arguments, type value) { arguments.u16(value); }
+  static type decode(const uint8_t* p, unsigned) { return get_u16(p); }
+};
+
+struct u32
+{
+  using type = uint32_t;
+  static const unsigned size = 4;
+  static void encode(Arguments& arguments, type value) { arguments.u32(value); }
+  static type decode(const uint8_t* p, unsigned) { return get_u32(p); }
+};
+
+// UCS-2 big endian text, decoded to UTF-8
+struct text
+{
+  using type = string;
+  static const unsigned size = 0;
+  static type decode(const uint8_t* p, unsigned length) { return ucs2_to_utf8(p, length); }
+};
+
+// Uninterpreted bytes
+struct raw
+{
+  using type = vector<uint8_t>;
+  static const unsigned size = 0;
+  static type decode(const uint8_t* p, unsigned length) { return type(p, p + length); }
+};
+
+};
+
+template <class... Fields>
+struct Layout
+{
+  static const unsigned fixed_size = (0 + ... + Fields::size);
+
+  template <size_t I>
+  static constexpr unsigned offset()
+  {
+    const unsigned sizes[] = { Fields::size..., 0 };
+    unsigned offset = 0;
+    for (size_t i = 0; i < I; i++) {
+      offset += sizes[i];
+    }
+    return offset;
+  }
+};
+
+template <class... Fields>
+struct Result
+{
+  using type = tuple<typename Fields::type...>;
+};
+
+template <class Field>
+struct Result<Field>
+{
+  using type = typename Field::type;
+};
+
+template <>
+struct Result<>
+{
+  using type = void;
+};
+
+// Compile time description of a command: its code, the layout of its
+// arguments and the layout of its response payload.  encode() builds
+// a Radio::Command from typed arguments, decode() extracts the typed
+// result from a response.  Results with more than one field are
+// returned as tuples.
+
+template <CommandType Type, auto Code, class ArgumentLayout, class ResponseLayout>
+struct Descriptor;
+
+template <CommandType Type, auto Code, class... A, class... R>
+struct Descriptor<Type, Code, Layout<A...>, Layout<R...>>
+{
+  static constexpr CommandType command_type = Type;
+  static constexpr uint8_t command = Code;
+  static constexpr string_view name = command_name(Type, Code);
+
+  using result = typename Result<R...>::type;
+
+  static Radio::Command encode(typename A::type... values)
+  {
+    Arguments arguments;
+    (A::encode(arguments, values), ...);
+    return { Type, command, arguments };
+  }
+
+  static result decode(const Response& response)
+  {
+    // Commands without a result are confirmed with an empty response to
+    // the same command, anything else is an error
+    if (response.command_type() != Type || response.command() != command) {
+      throw command_error(name, response.payload_length() ? response.payload()[0] : 0);
+    }
+    if constexpr (sizeof...(R) > 0) {
+      if (response.payload_length() < Layout<R...>::fixed_size) {
+        throw logic_error("Short response to " + string(name));
+      }
+      return decode_fields(response.payload(), response.payload_length(), index_sequence_for<R...>());
+    }
+  }
+
+private:
+  template <size_t... I>
+  static result decode_fields(const uint8_t* p, unsigned length, index_sequence<I...>)
+  {
+    return result(R::decode(p + Layout<R...>::template offset<I>(),
+                            length - Layout<R...>::template offset<I>())...);
+  }
+};
+
+namespace Commands {
+
+using Field::u8;
+using Field::u16;
+using Field::u32;
+using Field::text;
+using Field::raw;
+
+namespace System {
+  using GetSysRdy           = Descriptor<SYSTEM, SYSTEM_GetSysRdy, Layout<>, Layout<>>;
+  using Reset               = Descriptor<SYSTEM, SYSTEM_Reset, Layout<u8>, Layout<>>;
+  using GetMCUVersion       = Descriptor<SYSTEM, SYSTEM_GetMCUVersion, Layout<>, Layout<raw>>;
+  using GetAllVersion       = Descriptor<SYSTEM, SYSTEM_GetAllVersion, Layout<>, Layout<raw>>;
+  using GetModuleVersion    = Descriptor<SYSTEM, SYSTEM_GetModuleVersion, Layout<>, Layout<raw>>;
+};
+
+namespace Stream {
+  using Play                = Descriptor<STREAM, STREAM_Play, Layout<u8, u32>, Layout<>>;
+  using Stop                = Descriptor<STREAM, STREAM_Stop, Layout<>, Layout<>>;
+  using AutoSearch          = Descriptor<STREAM, STREAM_AutoSearch, Layout<u8, u8>, Layout<>>;
+  using StopSearch          = Descriptor<STREAM, STREAM_StopSearch, Layout<>, Layout<>>;
+  // play status, reserved, change mask
+  using GetPlayStatus       = Descriptor<STREAM, STREAM_GetPlayStatus, Layout<>, Layout<u8, u8, u8>>;
+  using GetPlayMode         = Descriptor<STREAM, STREAM_GetPlayMode, Layout<>, Layout<u8>>;
+  using GetPlayIndex        = Descriptor<STREAM, STREAM_GetPlayIndex, Layout<>, Layout<u32>>;
+  using GetTotalProgram     = Descriptor<STREAM, STREAM_GetTotalProgram, Layout<>, Layout<u32>>;
+  using GetSearchProgram    = Descriptor<STREAM, STREAM_GetSearchProgram, Layout<>, Layout<u8>>;
+  using GetSignalStrength   = Descriptor<STREAM, STREAM_GetSignalStrength, Layout<>, Layout<u8, u16>>;
+  using GetStereo           = Descriptor<STREAM, STREAM_GetStereo, Layout<>, Layout<u8>>;
+  using SetStereoMode       = Descriptor<STREAM, STREAM_SetStereoMode, Layout<u8>, Layout<>>;
+  using GetStereoMode       = Descriptor<STREAM, STREAM_GetStereoMode, Layout<>, Layout<u8>>;
+  using SetVolume           = Descriptor<STREAM, STREAM_SetVolume, Layout<u8>, Layout<>>;
+  using GetVolume           = Descriptor<STREAM, STREAM_GetVolume, Layout<>, Layout<u8>>;
+  using SetSorter           = Descriptor<STREAM, STREAM_SetSorter, Layout<u8>, Layout<>>;
+  using GetSorter           = Descriptor<STREAM, STREAM_GetSorter, Layout<>, Layout<u8>>;
+  using GetProgramType      = Descriptor<STREAM, STREAM_GetProgramType, Layout<u32>, Layout<u8>>;
+  using GetProgramName      = Descriptor<STREAM, STREAM_GetProgramName, Layout<u32>, Layout<text>>;
+  // The Playing variants leave out the index and answer for the program being played
+  using GetPlayingName      = Descriptor<STREAM, STREAM_GetProgramName, Layout<>, Layout<text>>;
+  using GetProgramText      = Descriptor<STREAM, STREAM_GetProgramText, Layout<>, Layout<text>>;
+  using GetEnsembleName     = Descriptor<STREAM, STREAM_GetEnsembleName, Layout<u32>, Layout<text>>;
+  using GetServiceName      = Descriptor<STREAM, STREAM_GetServiceName, Layout<>, Layout<text>>;
+  using GetDLSCmd           = Descriptor<STREAM, STREAM_GetDLSCmd, Layout<>, Layout<raw>>;
+  using GetFrequency        = Descriptor<STREAM, STREAM_GetFrequency, Layout<u32>, Layout<u8>>;
+  using GetPlayingFrequency = Descriptor<STREAM, STREAM_GetFrequency, Layout<>, Layout<u8>>;
+  using GetDataRate         = Descriptor<STREAM, STREAM_GetDataRate, Layout<>, Layout<u16>>;
+  using GetSignalQuality    = Descriptor<STREAM, STREAM_GetSignalQuality, Layout<>, Layout<u8>>;
+  // extended country code, country id
+  using GetECC              = Descriptor<STREAM, STREAM_GetECC, Layout<u32>, Layout<u8, u8>>;
+};
+
+namespace Rtc {
+  // seconds, minutes, hours, day, weekday, month, year
+  using GetClock            = Descriptor<RTC, RTC_GetClock, Layout<>, Layout<u8, u8, u8, u8, u8, u8, u8>>;
+};
+
+namespace Mot {
+  using GetAppData          = Descriptor<MOT, MOT_GetAppData, Layout<>, Layout<raw>>;
+};
+
+namespace Slave {
+  using SetNotification     = Descriptor<NOTIFICATION, SLAVE_SetNotification, Layout<u16>, Layout<>>;
+  using GetNotification     = Descriptor<NOTIFICATION, SLAVE_GetNotification, Layout<>, Layout<u16>>;
+};
+
+};
+
+};
@@ -0,0 +1,281 @@
+#include <control_server.h>
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace Oceanus {
+
+ControlServer::ControlServer(Reactor& reactor, const string& path)
+  : _reactor(reactor),
+    _path(path),
+    _fd(-1),
+    _next_client(1)
+{
+  struct sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof address.sun_path) {
+    throw invalid_argument("Socket path too long: " + path);
+  }
+  memcpy(address.sun_path, path.c_str(), path.size());
+
+  _fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (_fd < 0) {
+    throw runtime_error(string("Cannot create control socket: ") + strerror(errno));
+  }
+  unlink(path.c_str());
+  if (bind(_fd, reinterpret_cast<struct sockaddr*>(&address), sizeof address) < 0 || listen(_fd, 16) < 0) {
+    int error = errno;
+    close(_fd);
+    throw runtime_error("Cannot listen on " + path + ": " + strerror(error));
+  }
+  _reactor.add(_fd, EPOLLIN, [this](uint32_t) { accept_clients(); });
+}
+
+ControlServer::~ControlServer()
+{
+  while (!_clients.empty()) {
+    disconnect(_clients.begin()->first);
+  }
+  _reactor.remove(_fd);
+  close(_fd);
+  unlink(_path.c_str());
+}
+
+void
+ControlServer::accept_clients()
+{
+  for (;;) {
+    int fd = accept4(_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      // EAGAIN once the backlog is empty, anything else concerns only
+      // the client that was being accepted
+      return;
+    }
+    client_id id = _next_client++;
+    _clients[id].fd = fd;
+    _reactor.add(fd, EPOLLIN, [this, id](uint32_t events) { handle_events(id, events); });
+  }
+}
+
+void
+ControlServer::handle_events(client_id id, uint32_t events)
+{
+  if (events & EPOLLOUT) {
+    if (!flush(id)) {
+      return;
+    }
+  }
+  if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+    read_input(id);
+  }
+}
+
+void
+ControlServer::read_input(client_id id)
+{
+  char buffer[4096];
+  for (;;) {
+    auto client = _clients.find(id);
+    if (client == _clients.end()) {
+      return;
+    }
+    ssize_t length = read(client->second.fd, buffer, sizeof buffer);
+    if (length < 0 && errno == EINTR) {
+      continue;
+    }
+    if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    if (length <= 0) {
+      disconnect(id);
+      return;
+    }
+
+    auto& input = client->second.input;
+    input.append(buffer, length);
+    size_t start = 0;
+    size_t end;
+    while ((end = input.find('\n', start)) != string::npos) {
+      string line = input.substr(start, end - start);
+      start = end + 1;
+      if (line.size() && line.back() == '\r') {
+        line.pop_back();
+      }
+      handle_line(id, line);
+      client = _clients.find(id);
+      if (client == _clients.end()) {
+        return;
+      }
+    }
+    client->second.input.erase(0, start);
+    if (client->second.input.size() > _max_line) {
+      disconnect(id);
+      return;
+    }
+  }
+}
+
+void
+ControlServer::handle_line(client_id id, const string& line)
+{
+  istringstream words(line);
+  string command;
+  words >> command;
+  if (command.empty()) {
+    return;
+  }
+  string arguments;
+  getline(words, arguments);
+
+  if (command == "quit") {
+    disconnect(id);
+  } else if (command == "subscribe" || command == "unsubscribe") {
+    subscribe(_clients.at(id), arguments, command == "subscribe");
+    reply(id, "");
+  } else if (_command_handler) {
+    _command_handler(id, line);
+  } else {
+    reply(id, "", "Commands are not accepted");
+  }
+}
+
+void
+ControlServer::subscribe(Client& client, const string& arguments, bool subscribe)
+{
+  istringstream words(arguments);
+  string topic;
+  bool any = false;
+  while (words >> topic) {
+    any = true;
+    if (subscribe) {
+      client.topics.insert(topic);
+    } else {
+      client.topics.erase(topic);
+    }
+  }
+  if (!any) {
+    client.all_topics = subscribe;
+    client.topics.clear();
+  }
+}
+
+void
+ControlServer::reply(client_id id, const string& text, const string& error)
+{
+  if (!_clients.count(id)) {
+    return;
+  }
+  string answer = text;
+  if (answer.size() && answer.back() != '\n') {
+    answer += '\n';
+  }
+  answer += error.empty() ? "OK\n" : "ERROR " + error + "\n";
+  send(id, answer);
+}
+
+void
+ControlServer::publish(const string& topic, const string& text, const string& key)
+{
+  string line = "EVENT " + topic + " " + text + "\n";
+
+  // Sending may disconnect clients
+  vector<client_id> subscribers;
+  for (auto& [id, client] : _clients) {
+    if (client.all_topics || client.topics.count(topic)) {
+      subscribers.push_back(id);
+    }
+  }
+  for (auto id : subscribers) {
+    auto& client = _clients.at(id);
+    if (key.size()) {
+      if (client.output.size() - client.written > _coalesce_threshold) {
+        client.coalesced[key] = line;
+        continue;
+      }
+      // An older text must not follow this one
+      client.coalesced.erase(key);
+    }
+    send(id, line);
+  }
+}
+
+void
+ControlServer::send(client_id id, const string& text)
+{
+  auto& client = _clients.at(id);
+  if (client.written > _coalesce_threshold) {
+    client.output.erase(0, client.written);
+    client.written = 0;
+  }
+  client.output += text;
+  if (client.output.size() - client.written > _max_buffered) {
+    disconnect(id);
+    return;
+  }
+  flush(id);
+}
+
+bool
+ControlServer::flush(client_id id)
+{
+  auto& client = _clients.at(id);
+  for (;;) {
+    while (client.written < client.output.size()) {
+      ssize_t length = ::send(client.fd, client.output.data() + client.written, client.output.size() - client.written,
+                              MSG_NOSIGNAL | MSG_DONTWAIT);
+      if (length < 0 && errno == EINTR) {
+        continue;
+      }
+      if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        if (!client.writing) {
+          client.writing = true;
+          _reactor.modify(client.fd, EPOLLIN | EPOLLOUT);
+        }
+        return true;
+      }
+      if (length < 0) {
+        disconnect(id);
+        return false;
+      }
+      client.written += length;
+    }
+    client.output.clear();
+    client.written = 0;
+
+    // Caught up, so the latest of the held back events follow
+    if (client.coalesced.empty()) {
+      break;
+    }
+    for (auto& entry : client.coalesced) {
+      client.output += entry.second;
+    }
+    client.coalesced.clear();
+  }
+  if (client.writing) {
+    client.writing = false;
+    _reactor.modify(client.fd, EPOLLIN);
+  }
+  return true;
+}
+
+void
+ControlServer::disconnect(client_id id)
+{
+  auto client = _clients.find(id);
+  if (client == _clients.end()) {
+    return;
+  }
+  _reactor.remove(client->second.fd);
+  close(client->second.fd);
+  _clients.erase(client);
+}
+
+};
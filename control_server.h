@@ -0,0 +1,93 @@
+// -*- C++ -*-
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+#include <reactor.h>
+
+using namespace std;
+
+namespace Oceanus {
+
+// Line based control of a radio by local clients over a Unix stream
+// socket, served from the reactor thread.  Clients send one command
+// per line, which is passed to the command handler; the application
+// answers it with reply().  "subscribe [TOPIC...]" and "unsubscribe
+// [TOPIC...]" are handled here, without topics they apply to all.
+// Subscribed clients receive the events of their topics as lines
+// "EVENT <topic> <text>", never in the middle of a reply, so they need
+// not poll, and every event is produced once however many clients
+// there are.  "quit" closes the connection.
+//
+// Output to a client is buffered while the client does not read.
+// Once more than _coalesce_threshold bytes are waiting, events that
+// have a key only keep their latest text per key, sent when the
+// buffer has drained.  A client with more than _max_buffered bytes
+// waiting is disconnected.
+
+class ControlServer
+{
+public:
+  using client_id = uint64_t;
+
+  // Listens at path, replacing any socket left there
+  ControlServer(Reactor& reactor, const string& path);
+  ~ControlServer();
+
+  ControlServer(const ControlServer&) = delete;
+  ControlServer& operator=(const ControlServer&) = delete;
+
+  // Called with each command line.  The handler may not dispatch
+  // reactor events, commands that take time have to be queued.
+  using command_handler = function<void(client_id client, const string& command)>;
+  void on_command(command_handler handler) { _command_handler = handler; }
+
+  // Answer a command with text, which may hold several lines, and
+  // "OK" or "ERROR <error>".  Clients that have gone are ignored.
+  void reply(client_id client, const string& text, const string& error = "");
+
+  void publish(const string& topic, const string& text, const string& key = "");
+
+  size_t clients() const { return _clients.size(); }
+
+private:
+  const size_t _coalesce_threshold = 16 * 1024;
+  const size_t _max_buffered = 256 * 1024;
+  const size_t _max_line = 4096;
+
+  struct Client {
+    int fd;
+    string input;
+    string output;
+    size_t written = 0;             // of output
+    map<string, string> coalesced;  // latest event text by key
+    set<string> topics;
+    bool all_topics = false;
+    bool writing = false;           // waiting for EPOLLOUT
+  };
+
+  Reactor& _reactor;
+  string _path;
+  int _fd;
+  client_id _next_client;
+  unordered_map<client_id, Client> _clients;
+
+  command_handler _command_handler;
+
+  void accept_clients();
+  void handle_events(client_id id, uint32_t events);
+  void read_input(client_id id);
+  void handle_line(client_id id, const string& line);
+  void subscribe(Client& client, const string& arguments, bool subscribe);
+  void send(client_id id, const string& text);
+  bool flush(client_id id);
+  void disconnect(client_id id);
+};
+
+};
@@ -0,0 +1,159 @@
+#include <flight_recorder.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+namespace Oceanus {
+
+// State for handle_signal(), set up before the handler is installed
+static const FlightRecorder* signal_recorder;
+static char signal_path[4096];
+
+FlightRecorder::FlightRecorder(size_t capacity, unsigned max_capture)
+  : _ring(capacity),
+    _max_capture(max_capture),
+    _head(0),
+    _tail(0)
+{
+}
+
+FlightRecorder::~FlightRecorder()
+{
+  if (signal_recorder == this) {
+    signal_recorder = nullptr;
+  }
+}
+
+void
+FlightRecorder::copy_in(uint64_t offset, const void* data, size_t length)
+{
+  size_t position = offset % _ring.size();
+  size_t first = min(length, _ring.size() - position);
+  memcpy(&_ring[position], data, first);
+  memcpy(&_ring[0], static_cast<const uint8_t*>(data) + first, length - first);
+}
+
+void
+FlightRecorder::copy_out(uint64_t offset, void* data, size_t length) const
+{
+  size_t position = offset % _ring.size();
+  size_t first = min(length, _ring.size() - position);
+  memcpy(data, &_ring[position], first);
+  memcpy(static_cast<uint8_t*>(data) + first, &_ring[0], length - first);
+}
+
+void
+FlightRecorder::record(Direction direction, const uint8_t* data, unsigned length)
+{
+  Record record;
+  record.timestamp = chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+  record.length = length;
+  record.captured = min(length, _max_capture);
+  record.direction = direction;
+  record.reserved = 0;
+
+  uint64_t size = sizeof record + record.captured;
+  if (size > _ring.size()) {
+    return;
+  }
+
+  // Drop the oldest records until the new one fits
+  uint64_t head = _head.load(memory_order_relaxed);
+  uint64_t tail = _tail.load(memory_order_relaxed);
+  while (head + size - tail > _ring.size()) {
+    Record oldest;
+    copy_out(tail, &oldest, sizeof oldest);
+    tail += sizeof oldest + oldest.captured;
+  }
+  _tail.store(tail, memory_order_release);
+
+  copy_in(head, &record, sizeof record);
+  copy_in(head + sizeof record, data, record.captured);
+  _head.store(head + size, memory_order_release);
+}
+
+static bool
+write_all(int fd, const void* data, size_t length)
+{
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  while (length) {
+    ssize_t result = ::write(fd, p, length);
+    if (result == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    p += result;
+    length -= result;
+  }
+  return true;
+}
+
+bool
+FlightRecorder::dump(const char* path) const
+{
+  uint64_t tail = _tail.load(memory_order_acquire);
+  uint64_t head = _head.load(memory_order_acquire);
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    return false;
+  }
+
+  FileHeader header;
+  memcpy(header.magic, magic, sizeof header.magic);
+  header.version = version;
+  header.record_size = sizeof(Record);
+  header.length = head - tail;
+
+  size_t position = tail % _ring.size();
+  size_t first = min<uint64_t>(head - tail, _ring.size() - position);
+  bool written = write_all(fd, &header, sizeof header)
+    && write_all(fd, &_ring[position], first)
+    && write_all(fd, &_ring[0], head - tail - first);
+
+  return close(fd) == 0 && written;
+}
+
+void
+FlightRecorder::handle_signal(int signal)
+{
+  int saved_errno = errno;
+  if (signal_recorder) {
+    signal_recorder->dump(signal_path);
+  }
+  errno = saved_errno;
+
+  if (signal == SIGSEGV || signal == SIGBUS || signal == SIGFPE || signal == SIGILL || signal == SIGABRT) {
+    ::signal(signal, SIG_DFL);
+    raise(signal);
+  }
+}
+
+void
+FlightRecorder::dump_on_signal(const string& path, initializer_list<int> signals)
+{
+  if (path.length() >= sizeof signal_path) {
+    throw length_error("Flight recorder dump path too long");
+  }
+  strcpy(signal_path, path.c_str());
+  signal_recorder = this;
+
+  struct sigaction action = {};
+  action.sa_handler = handle_signal;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  for (int signal : signals) {
+    sigaction(signal, &action, nullptr);
+  }
+}
+
+};
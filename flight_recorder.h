@@ -0,0 +1,82 @@
+// -*- C++ -*-
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace Oceanus {
+
+// Fixed size ring of the most recent frames exchanged with the module.
+// Recording copies the frame into the ring and never allocates or
+// locks; the oldest records are overwritten when the ring is full.
+// Only one thread, the reactor thread, may record.
+//
+// dump() writes the ring to a file using nothing but open(), write()
+// and close(), so it may be called from a signal handler.  The file
+// starts with a FileHeader followed by the records from oldest to
+// newest, and is decoded by radio-trace.
+
+class FlightRecorder
+{
+public:
+  enum Direction : uint8_t {
+    Sent     = 0,      // request frame
+    Received = 1,      // response or notification frame
+    Timeout  = 2       // command type and command of a call that timed out
+  };
+
+  struct Record {
+    uint64_t timestamp;     // nanoseconds since the epoch
+    uint32_t length;        // of the frame
+    uint16_t captured;      // bytes of the frame that follow
+    Direction direction;
+    uint8_t reserved;
+  };
+
+  struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t length;        // bytes of records that follow
+  };
+
+  static constexpr char magic[8] = { 'T', '4', 'B', 'T', 'R', 'A', 'C', 'E' };
+  static const uint32_t version = 1;
+
+  FlightRecorder(size_t capacity = 256 * 1024, unsigned max_capture = 256);
+  ~FlightRecorder();
+
+  FlightRecorder(const FlightRecorder&) = delete;
+  FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+  void record(Direction direction, const uint8_t* data, unsigned length);
+
+  // Returns false if the file could not be written
+  bool dump(const char* path) const;
+
+  // Dump to path when one of the signals arrives.  Fatal signals are
+  // re-raised with the default action afterwards, others return.
+  // There can be only one recorder dumping on signals per process.
+  void dump_on_signal(const string& path, initializer_list<int> signals);
+
+private:
+  vector<uint8_t> _ring;
+  const unsigned _max_capture;
+
+  // Monotonic byte offsets; the ring holds the records in [_tail, _head)
+  atomic<uint64_t> _head;
+  atomic<uint64_t> _tail;
+
+  void copy_in(uint64_t offset, const void* data, size_t length);
+  void copy_out(uint64_t offset, void* data, size_t length) const;
+
+  static void handle_signal(int signal);
+};
+
+};
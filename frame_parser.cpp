@@ -0,0 +1,101 @@
+#include <frame_parser.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace Oceanus {
+
+FrameParser::FrameParser(unsigned max_payload)
+  : _max_payload(max_payload),
+    // Room for one maximum size frame plus the beginning of the next
+    _buffer(2 * (header_length + max_payload + 1)),
+    _begin(0),
+    _end(0),
+    _frames(0),
+    _discarded(0),
+    _resyncs(0)
+{
+}
+
+uint8_t*
+FrameParser::write_space(size_t& available)
+{
+  if (_begin == _end) {
+    _begin = _end = 0;
+  } else if (_buffer.size() - _end < _buffer.size() / 2) {
+    // Move the partial frame to the front.  This is rare and cheap, as
+    // frames are normally consumed as soon as they are complete.
+    memmove(_buffer.data(), _buffer.data() + _begin, _end - _begin);
+    _end -= _begin;
+    _begin = 0;
+  }
+  available = _buffer.size() - _end;
+  return _buffer.data() + _end;
+}
+
+void
+FrameParser::discard(size_t count)
+{
+  _begin += count;
+  _discarded += count;
+}
+
+// Skip to the next possible start of a frame
+void
+FrameParser::skip()
+{
+  const uint8_t* start = _buffer.data() + _begin;
+  size_t available = _end - _begin;
+  auto found = static_cast<const uint8_t*>(memchr(start, 0xfe, available));
+  discard(found ? found - start : available);
+}
+
+void
+FrameParser::resync()
+{
+  if (_begin != _end) {
+    discard(1);
+    skip();
+    _resyncs++;
+  }
+}
+
+bool
+FrameParser::next(FrameView& frame)
+{
+  while (true) {
+    const uint8_t* start = _buffer.data() + _begin;
+    size_t available = _end - _begin;
+
+    if (available && start[0] != 0xfe) {
+      skip();
+      _resyncs++;
+      continue;
+    }
+
+    if (available < header_length) {
+      return false;
+    }
+
+    unsigned length = (start[4] << 8) | start[5];
+    if (length > _max_payload) {
+      resync();
+      continue;
+    }
+    if (available < header_length + length + 1) {
+      return false;
+    }
+    if (start[header_length + length] != 0xfd) {
+      resync();
+      continue;
+    }
+
+    frame.data = start;
+    frame.length = header_length + length + 1;
+    _begin += frame.length;
+    _frames++;
+    return true;
+  }
+}
+
+};
@@ -0,0 +1,73 @@
+// -*- C++ -*-
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+using namespace std;
+
+namespace Oceanus {
+
+// A complete frame inside the parser's receive buffer.  The view is
+// only valid until the next call to write_space().
+struct FrameView
+{
+  const uint8_t* data;
+  unsigned length;
+
+  uint8_t command_type() const { return data[1]; }
+  uint8_t command() const { return data[2]; }
+  uint8_t sequence_number() const { return data[3]; }
+  const uint8_t* payload() const { return data + 6; }
+  unsigned payload_length() const { return length - 7; }
+};
+
+// Incremental parser for 0xFE ... 0xFD framed data.  Bytes are read
+// directly into the receive buffer and frames are located in place.
+// Data that cannot be the start of a valid frame is skipped up to the
+// next 0xFE and counted as discarded.
+
+class FrameParser
+{
+public:
+  static const unsigned header_length = 6;
+
+  FrameParser(unsigned max_payload);
+
+  // Contiguous free space at the end of the receive buffer.  Fill it
+  // and report the number of bytes stored with commit().
+  uint8_t* write_space(size_t& available);
+  void commit(size_t count) { _end += count; }
+
+  // Locate the next complete frame.  Returns false if more data is
+  // needed.
+  bool next(FrameView& frame);
+
+  // Give up on a frame that has started but not been completed, for
+  // example because its length field was corrupted.
+  void resync();
+
+  size_t buffered() const { return _end - _begin; }
+  uint64_t frames() const { return _frames; }
+  uint64_t discarded() const { return _discarded; }
+  // Runs of data skipped between frames and frames given up on
+  uint64_t resyncs() const { return _resyncs; }
+
+private:
+  const unsigned _max_payload;
+
+  vector<uint8_t> _buffer;
+  size_t _begin;
+  size_t _end;
+
+  uint64_t _frames;
+  uint64_t _discarded;
+  uint64_t _resyncs;
+
+  void discard(size_t count);
+  void skip();
+};
+
+};
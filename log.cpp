@@ -0,0 +1,108 @@
+#include <log.h>
+
+#include <ctime>
+#include <iomanip>
+
+namespace Oceanus {
+
+Logger&
+logger()
+{
+  static Logger instance;
+  return instance;
+}
+
+Logger::Logger(ostream& output)
+  : _level(LOG_WARNING),
+    _output(&output),
+    _writing(false),
+    _stopping(false)
+{
+}
+
+Logger::~Logger()
+{
+  {
+    lock_guard<mutex> lock(_mutex);
+    _stopping = true;
+  }
+  _queued.notify_one();
+  if (_thread.joinable()) {
+    _thread.join();
+  }
+}
+
+const char*
+Logger::level_name(LogLevel level)
+{
+  static const char* const names[] = { "error", "warning", "info", "debug", "trace" };
+  return names[level];
+}
+
+void
+Logger::set_output(ostream& output)
+{
+  lock_guard<mutex> lock(_mutex);
+  _output = &output;
+}
+
+void
+Logger::log(LogLevel level, formatter format)
+{
+  {
+    lock_guard<mutex> lock(_mutex);
+    _queue.push_back({ level, chrono::system_clock::now(), move(format) });
+    if (!_thread.joinable()) {
+      _thread = thread([this]() { run(); });
+    }
+  }
+  _queued.notify_one();
+}
+
+void
+Logger::flush()
+{
+  unique_lock<mutex> lock(_mutex);
+  _drained.wait(lock, [this]() { return _queue.empty() && !_writing; });
+}
+
+void
+Logger::run()
+{
+  unique_lock<mutex> lock(_mutex);
+  for (;;) {
+    _queued.wait(lock, [this]() { return _stopping || !_queue.empty(); });
+    if (_queue.empty()) {
+      return;
+    }
+    Entry entry = move(_queue.front());
+    _queue.pop_front();
+    _writing = true;
+    ostream& output = *_output;
+    lock.unlock();
+    write(output, entry);
+    lock.lock();
+    _writing = false;
+    if (_queue.empty()) {
+      _drained.notify_all();
+    }
+  }
+}
+
+void
+Logger::write(ostream& os, const Entry& entry)
+{
+  time_t seconds = chrono::system_clock::to_time_t(entry.time);
+  auto microseconds = chrono::duration_cast<chrono::microseconds>(entry.time.time_since_epoch()).count() % 1000000;
+  struct tm local;
+  localtime_r(&seconds, &local);
+  char time[16];
+  strftime(time, sizeof time, "%T", &local);
+
+  os << time << '.' << setw(6) << setfill('0') << microseconds << setfill(' ')
+     << ' ' << level_name(entry.level) << ": ";
+  entry.format(os);
+  os << endl;
+}
+
+};
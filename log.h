@@ -0,0 +1,96 @@
+// -*- C++ -*-
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+namespace Oceanus {
+
+enum LogLevel {
+  LOG_ERROR   = 0,
+  LOG_WARNING = 1,
+  LOG_INFO    = 2,
+  LOG_DEBUG   = 3,
+  LOG_TRACE   = 4
+};
+
+// Messages above this level are compiled out entirely
+#ifndef OCEANUS_MAX_LOG_LEVEL
+#define OCEANUS_MAX_LOG_LEVEL LOG_TRACE
+#endif
+
+// Asynchronous logger.  A message is a function that writes to an
+// ostream; it is queued together with its timestamp and run on the
+// logger's own thread, so formatting costs nothing on the caller's
+// thread beyond capturing the arguments.  Use the OCEANUS_LOG macro,
+// which does not evaluate its arguments when the level is disabled.
+
+class Logger
+{
+public:
+  using formatter = function<void(ostream& os)>;
+
+  Logger(ostream& output = cerr);
+  ~Logger();
+
+  Logger(const Logger&) = delete;
+  Logger& operator=(const Logger&) = delete;
+
+  bool enabled(LogLevel level) const
+  {
+    return level <= OCEANUS_MAX_LOG_LEVEL && level <= _level.load(memory_order_relaxed);
+  }
+  void set_level(LogLevel level) { _level = level; }
+  LogLevel level() const { return _level; }
+
+  void set_output(ostream& output);
+
+  void log(LogLevel level, formatter format);
+
+  // Wait until all queued messages have been written
+  void flush();
+
+  static const char* level_name(LogLevel level);
+
+private:
+  struct Entry {
+    LogLevel level;
+    chrono::system_clock::time_point time;
+    formatter format;
+  };
+
+  atomic<LogLevel> _level;
+  ostream* _output;
+
+  mutex _mutex;
+  condition_variable _queued;
+  condition_variable _drained;
+  deque<Entry> _queue;
+  bool _writing;
+  bool _stopping;
+  thread _thread;
+
+  void run();
+  void write(ostream& os, const Entry& entry);
+};
+
+// The process wide logger
+Logger& logger();
+
+#define OCEANUS_LOG(level, ...)                                         \
+  do {                                                                  \
+    if (::Oceanus::logger().enabled(level)) {                           \
+      ::Oceanus::logger().log(level, __VA_ARGS__);                      \
+    }                                                                   \
+  } while (0)
+
+};
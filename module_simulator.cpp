@@ -0,0 +1,618 @@
+#include <module_simulator.h>
+#include <commands.h>
+
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <system_error>
+
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace Oceanus {
+
+static const char16_t* const station_names[] = {
+  u"Antenne", u"Bayern 3", u"Deutschlandfunk", u"Ö1 Klassik", u"Radio Fritz",
+  u"Jazz Café", u"Klassik Radio", u"NDR Kultur", u"Rádio Comércial", u"Sunshine Live"
+};
+
+static const char16_t* const texts[] = {
+  u"Now playing: Blue in Green - Miles Davis",
+  u"Traffic: No delays reported",
+  u"Weather: Sunny, 24°C",
+  u"Up next: The News at the top of the hour",
+  u"Now playing: Götterdämmerung - Wagner"
+};
+
+ModuleSimulator::ModuleSimulator(Reactor& reactor, const Options& options, output_function output)
+  : _reactor(reactor),
+    _options(options),
+    _output(output),
+    _parser(Packet::max_payload),
+    _random(options.seed),
+    _found(options.programs),
+    _search_channel(0),
+    _status(Stopped),
+    _play_mode(0),
+    _play_index(0),
+    _changes(0),
+    _volume(10),
+    _stereo_mode(1),
+    _sorter(0),
+    _notifications(0),
+    _text_counter(0),
+    _mot_offset(0),
+    _mot_counter(0),
+    _requests(0),
+    _line_free(Reactor::clock::now())
+{
+  build_database();
+  schedule(_options.dls_interval, [this]() { update_text(); });
+  schedule(_options.mot_interval, [this]() { update_mot(); });
+}
+
+ModuleSimulator::~ModuleSimulator()
+{
+  for (auto id : _timers) {
+    _reactor.cancel_timer(id);
+  }
+}
+
+void
+ModuleSimulator::parse_latency(Options& options, const string& spec)
+{
+  auto equals = spec.find('=');
+  if (equals == string::npos) {
+    options.latency = chrono::microseconds((long) (stod(spec) * 1000));
+    return;
+  }
+
+  string name = spec.substr(0, equals);
+  auto latency = chrono::microseconds((long) (stod(spec.substr(equals + 1)) * 1000));
+  for (uint8_t command_type : { SYSTEM, STREAM, RTC, MOT, NOTIFICATION, GPIO }) {
+    for (unsigned command = 0; command < 256; command++) {
+      if (command_name(command_type, command) == name) {
+        options.command_latency[command_type << 8 | command] = latency;
+        return;
+      }
+    }
+  }
+  throw invalid_argument("Unknown command name: " + name);
+}
+
+void
+ModuleSimulator::build_database()
+{
+  const unsigned station_count = sizeof station_names / sizeof station_names[0];
+
+  _database.clear();
+  for (unsigned i = 0; i < _options.programs; i++) {
+    unsigned ensemble = i / _options.programs_per_ensemble;
+    Program program;
+    program.name = station_names[i % station_count];
+    if (i >= station_count) {
+      auto number = to_string(i / station_count + 1);
+      program.name += u' ';
+      program.name.append(number.begin(), number.end());
+    }
+    auto ensemble_number = to_string(ensemble + 1);
+    program.ensemble = u"Multiplex ";
+    program.ensemble.append(ensemble_number.begin(), ensemble_number.end());
+    program.program_type = i % 32;
+    program.frequency_index = (5 + ensemble * 3) % 41;
+    program.ecc = 0xe0;
+    _database.push_back(program);
+  }
+}
+
+void
+ModuleSimulator::schedule(chrono::microseconds delay, function<void()> action)
+{
+  auto id = make_shared<Reactor::timer_id>();
+  *id = _reactor.add_timer(Reactor::clock::now() + delay,
+                           [this, id, action]() {
+                             _timers.erase(*id);
+                             action();
+                           });
+  _timers.insert(*id);
+}
+
+void
+ModuleSimulator::receive(const uint8_t* data, size_t length)
+{
+  while (length) {
+    size_t available;
+    uint8_t* space = _parser.write_space(available);
+    size_t count = min(available, length);
+    memcpy(space, data, count);
+    _parser.commit(count);
+    data += count;
+    length -= count;
+
+    FrameView request;
+    while (_parser.next(request)) {
+      _requests++;
+      handle(request);
+    }
+  }
+}
+
+void
+ModuleSimulator::send(uint8_t command_type, uint8_t command, uint8_t sequence_number, const vector<uint8_t>& payload,
+                      chrono::microseconds latency)
+{
+  vector<uint8_t> frame = { 0xfe, command_type, command, sequence_number,
+                            (uint8_t) (payload.size() >> 8), (uint8_t) (payload.size() & 0xff) };
+  frame.insert(frame.end(), payload.begin(), payload.end());
+  frame.push_back(0xfd);
+
+  if (_options.noise > 0) {
+    uniform_real_distribution<double> chance(0, 1);
+    vector<uint8_t> noisy;
+    for (auto byte : frame) {
+      if (chance(_random) < _options.noise) {
+        noisy.push_back(_random());
+      }
+      noisy.push_back(chance(_random) < _options.noise ? (uint8_t) _random() : byte);
+    }
+    frame.swap(noisy);
+  }
+
+  // Responses leave the module one after the other at the line speed
+  auto now = Reactor::clock::now();
+  auto start = max(now + latency, _line_free);
+  chrono::microseconds transfer(0);
+  if (_options.baud_rate) {
+    transfer = chrono::microseconds(frame.size() * 10 * 1000000ull / _options.baud_rate);
+  }
+  _line_free = start + transfer;
+
+  auto delay = chrono::duration_cast<chrono::microseconds>(_line_free - now);
+  schedule(delay, [this, frame]() { _output(frame.data(), frame.size()); });
+}
+
+void
+ModuleSimulator::reply(const FrameView& request, const vector<uint8_t>& payload)
+{
+  auto latency = _options.latency;
+  auto override = _options.command_latency.find(request.command_type() << 8 | request.command());
+  if (override != _options.command_latency.end()) {
+    latency = override->second;
+  }
+  send(request.command_type(), request.command(), request.sequence_number(), payload, latency);
+}
+
+void
+ModuleSimulator::reply_error(const FrameView& request, uint8_t error_code)
+{
+  send(0x00, 0x02, request.sequence_number(), { error_code }, _options.latency);
+}
+
+void
+ModuleSimulator::notify(uint16_t event)
+{
+  if (_notifications & event) {
+    send(NOTIFICATION, SLAVE_GetNotification, 0, { (uint8_t) (event >> 8), (uint8_t) event }, _options.latency);
+  }
+}
+
+vector<uint8_t>
+ModuleSimulator::ucs2(const u16string& text)
+{
+  vector<uint8_t> bytes;
+  bytes.reserve(text.size() * 2);
+  for (auto c : text) {
+    bytes.push_back(c >> 8);
+    bytes.push_back(c & 0xff);
+  }
+  return bytes;
+}
+
+vector<uint8_t>
+ModuleSimulator::u32(uint32_t value)
+{
+  return { (uint8_t) (value >> 24), (uint8_t) (value >> 16), (uint8_t) (value >> 8), (uint8_t) value };
+}
+
+void
+ModuleSimulator::handle(const FrameView& request)
+{
+  switch (request.command_type()) {
+  case SYSTEM:
+    handle_system(request);
+    break;
+  case STREAM:
+    handle_stream(request);
+    break;
+  case RTC:
+    handle_rtc(request);
+    break;
+  case MOT:
+    handle_mot(request);
+    break;
+  case NOTIFICATION:
+    handle_notification(request);
+    break;
+  default:
+    reply(request, {});
+  }
+}
+
+void
+ModuleSimulator::handle_system(const FrameView& request)
+{
+  auto version = [](const string& text) { return vector<uint8_t>(text.begin(), text.end()); };
+
+  switch (request.command()) {
+  case SYSTEM_GetSysRdy:
+    reply(request, {});
+    break;
+  case SYSTEM_Reset:
+    reply(request, {});
+    if (request.payload_length() >= 1 && request.payload()[0] != Radio::REBOOT) {
+      _found = 0;
+    }
+    _status = Stopped;
+    break;
+  case SYSTEM_GetMCUVersion:
+    reply(request, version("SIM-MCU 1.0.0"));
+    break;
+  case SYSTEM_GetBootVersion:
+    reply(request, version("SIM-BOOT 1.0.0"));
+    break;
+  case SYSTEM_GetASPVersion:
+    reply(request, version("SIM-ASP 1.0.0"));
+    break;
+  case SYSTEM_GetAllVersion:
+    reply(request, version("SIM-MCU 1.0.0 SIM-BOOT 1.0.0 SIM-ASP 1.0.0 programs=" + to_string(_options.programs)));
+    break;
+  case SYSTEM_GetModuleVersion:
+    reply(request, version("T4B-SIM"));
+    break;
+  default:
+    reply_error(request, 1);
+  }
+}
+
+void
+ModuleSimulator::tune(uint8_t mode, uint32_t index)
+{
+  _play_mode = mode;
+  _play_index = index;
+  _status = Tuning;
+  _program_text.clear();
+  schedule(_options.tune_time, [this, index]() {
+    if (_status == Tuning && _play_index == index) {
+      _status = Playing;
+      _changes |= 0x01 | 0x10 | 0x40;
+    }
+  });
+}
+
+void
+ModuleSimulator::search_step(unsigned channel, unsigned last)
+{
+  _search_channel = channel;
+  schedule(_options.search_time / channels, [this, channel, last]() {
+    if (_status != Searching || _search_channel != channel) {
+      return;
+    }
+    _found = max(_found, _options.programs * (channel + 1) / channels);
+    if (channel == last) {
+      _status = Stopped;
+      notify(NOTIFY_ScanFinished);
+      return;
+    }
+    search_step(channel + 1, last);
+  });
+}
+
+void
+ModuleSimulator::update_text()
+{
+  if (_status == Playing) {
+    const unsigned text_count = sizeof texts / sizeof texts[0];
+    _program_text = texts[_text_counter++ % text_count];
+    _changes |= 0x02;
+    notify(NOTIFY_NewProgramText);
+  }
+  schedule(_options.dls_interval, [this]() { update_text(); });
+}
+
+void
+ModuleSimulator::update_mot()
+{
+  if (_status == Playing) {
+    _mot_object.resize(_options.mot_object_size);
+    for (auto& byte : _mot_object) {
+      byte = _mot_counter + (&byte - _mot_object.data());
+    }
+    _mot_counter++;
+    _mot_offset = 0;
+  }
+  schedule(_options.mot_interval, [this]() { update_mot(); });
+}
+
+void
+ModuleSimulator::handle_stream(const FrameView& request)
+{
+  const uint8_t* arguments = request.payload();
+  unsigned argument_length = request.payload_length();
+  bool has_index = argument_length >= 4;
+  uint32_t index = has_index ? get_u32(arguments) : _play_index;
+  bool valid_index = index < _found;
+
+  switch (request.command()) {
+  case STREAM_Play:
+    if (argument_length < 5 || (arguments[0] == 0 && get_u32(arguments + 1) >= _found)) {
+      reply_error(request, 1);
+      break;
+    }
+    reply(request, {});
+    tune(arguments[0], get_u32(arguments + 1));
+    break;
+  case STREAM_Stop:
+    _status = Stopped;
+    reply(request, {});
+    break;
+  case STREAM_AutoSearch: {
+    // Programs on the channels before the first are kept, so an
+    // interrupted search can be continued
+    unsigned first = argument_length >= 1 ? arguments[0] : 0;
+    unsigned last = min(argument_length >= 2 ? arguments[1] : channels - 1, channels - 1);
+    if (first > last) {
+      reply_error(request, 1);
+      break;
+    }
+    reply(request, {});
+    _status = Searching;
+    _found = min(_found, _options.programs * first / channels);
+    search_step(first, last);
+    break;
+  }
+  case STREAM_StopSearch:
+    if (_status == Searching) {
+      _status = Stopped;
+    }
+    reply(request, {});
+    break;
+  case STREAM_GetPlayStatus:
+    reply(request, { (uint8_t) _status, 0, _changes });
+    _changes = 0;
+    break;
+  case STREAM_GetPlayMode:
+    reply(request, { _play_mode });
+    break;
+  case STREAM_GetPlayIndex:
+    reply(request, u32(_play_index));
+    break;
+  case STREAM_GetTotalProgram:
+    reply(request, u32(_found));
+    break;
+  case STREAM_GetSearchProgram:
+    reply(request, { (uint8_t) (_status == Searching ? _search_channel : 0) });
+    break;
+  case STREAM_GetSignalStrength:
+    reply(request, { 80, 0, 0 });
+    break;
+  case STREAM_GetStereo:
+    reply(request, { _stereo_mode });
+    break;
+  case STREAM_SetStereoMode:
+    _stereo_mode = argument_length ? arguments[0] : 0;
+    reply(request, {});
+    break;
+  case STREAM_GetStereoMode:
+    reply(request, { _stereo_mode });
+    break;
+  case STREAM_SetVolume:
+    _volume = argument_length ? min<uint8_t>(arguments[0], 16) : 0;
+    reply(request, {});
+    break;
+  case STREAM_GetVolume:
+    reply(request, { _volume });
+    break;
+  case STREAM_SetSorter:
+    _sorter = argument_length ? arguments[0] : 0;
+    reply(request, {});
+    notify(NOTIFY_SortChanged);
+    break;
+  case STREAM_GetSorter:
+    reply(request, { _sorter });
+    break;
+  case STREAM_GetProgramType:
+    if (!valid_index) {
+      reply_error(request, 1);
+      break;
+    }
+    reply(request, { _database[index].program_type });
+    break;
+  case STREAM_GetProgramName:
+  case STREAM_GetServiceName:
+    if (!valid_index) {
+      reply_error(request, 1);
+      break;
+    }
+    reply(request, ucs2(_database[index].name));
+    break;
+  case STREAM_GetEnsembleName:
+    if (!valid_index) {
+      reply_error(request, 1);
+      break;
+    }
+    reply(request, ucs2(_database[index].ensemble));
+    break;
+  case STREAM_GetProgramText:
+    if (_program_text.empty()) {
+      reply_error(request, 1);
+      break;
+    }
+    reply(request, ucs2(_program_text));
+    break;
+  case STREAM_GetDLSCmd:
+    reply(request, { 0 });
+    break;
+  case STREAM_GetFrequency:
+    if (!valid_index) {
+      reply_error(request, 1);
+      break;
+    }
+    reply(request, { _database[index].frequency_index });
+    break;
+  case STREAM_GetDataRate:
+    reply(request, { 0, 128 });
+    break;
+  case STREAM_GetSignalQuality:
+    reply(request, { (uint8_t) (_status == Playing ? 90 : 0) });
+    break;
+  case STREAM_GetECC:
+    if (!valid_index) {
+      reply_error(request, 1);
+      break;
+    }
+    reply(request, { _database[index].ecc, 0x0d });
+    break;
+  default:
+    reply(request, {});
+  }
+}
+
+void
+ModuleSimulator::handle_rtc(const FrameView& request)
+{
+  if (request.command() != RTC_GetClock) {
+    reply(request, {});
+    return;
+  }
+  time_t now = time(nullptr);
+  struct tm local;
+  localtime_r(&now, &local);
+  reply(request, { (uint8_t) local.tm_sec, (uint8_t) local.tm_min, (uint8_t) local.tm_hour,
+                   (uint8_t) local.tm_mday, (uint8_t) local.tm_wday, (uint8_t) (local.tm_mon + 1),
+                   (uint8_t) (local.tm_year % 100) });
+}
+
+void
+ModuleSimulator::handle_mot(const FrameView& request)
+{
+  const size_t chunk_size = 512;
+
+  if (request.command() != MOT_GetAppData || _mot_offset >= _mot_object.size()) {
+    reply_error(request, 1);
+    return;
+  }
+  size_t length = min(chunk_size, _mot_object.size() - _mot_offset);
+  reply(request, vector<uint8_t>(_mot_object.begin() + _mot_offset, _mot_object.begin() + _mot_offset + length));
+  _mot_offset += length;
+}
+
+void
+ModuleSimulator::handle_notification(const FrameView& request)
+{
+  switch (request.command()) {
+  case SLAVE_SetNotification:
+    _notifications = request.payload_length() >= 2 ? get_u16(request.payload()) : 0;
+    reply(request, {});
+    break;
+  case SLAVE_GetNotification:
+    reply(request, { (uint8_t) (_notifications >> 8), (uint8_t) _notifications });
+    break;
+  default:
+    reply_error(request, 1);
+  }
+}
+
+PtyModule::PtyModule(Reactor& reactor, const ModuleSimulator::Options& options)
+  : _reactor(reactor),
+    _master(-1),
+    _slave(-1),
+    _simulator(reactor, options, [this](const uint8_t* data, size_t length) { write(data, length); })
+{
+  open_pty();
+}
+
+PtyModule::~PtyModule()
+{
+  if (_master != -1) {
+    _reactor.remove(_master);
+  }
+  close(_slave);
+  close(_master);
+}
+
+void
+PtyModule::open_pty()
+{
+  _master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (_master == -1 || grantpt(_master) == -1 || unlockpt(_master) == -1) {
+    throw system_error(errno, generic_category(), "Cannot create pseudo terminal");
+  }
+  _slave_name = ptsname(_master);
+
+  _slave = open(_slave_name.c_str(), O_RDWR | O_NOCTTY);
+  if (_slave == -1) {
+    throw system_error(errno, generic_category(), "Cannot open " + _slave_name);
+  }
+  struct termios options;
+  tcgetattr(_slave, &options);
+  cfmakeraw(&options);
+  tcsetattr(_slave, TCSANOW, &options);
+
+  _reactor.add(_master, EPOLLIN, [this](uint32_t events) { handle_io(events); });
+}
+
+void
+PtyModule::handle_io(uint32_t events)
+{
+  if (events & EPOLLIN) {
+    uint8_t buffer[4096];
+    int result = ::read(_master, buffer, sizeof buffer);
+    if (result > 0) {
+      _simulator.receive(buffer, result);
+    } else if (result == -1 && errno != EAGAIN && errno != EIO) {
+      throw system_error(errno, generic_category(), "Error reading from pseudo terminal");
+    }
+  }
+  if (events & EPOLLOUT) {
+    flush();
+  }
+}
+
+void
+PtyModule::write(const uint8_t* data, size_t length)
+{
+  _output.insert(_output.end(), data, data + length);
+  flush();
+}
+
+void
+PtyModule::flush()
+{
+  while (!_output.empty()) {
+    uint8_t buffer[4096];
+    size_t length = min(_output.size(), sizeof buffer);
+    copy_n(_output.begin(), length, buffer);
+    int result = ::write(_master, buffer, length);
+    if (result == -1) {
+      if (errno != EAGAIN) {
+        throw system_error(errno, generic_category(), "Error writing to pseudo terminal");
+      }
+      _reactor.modify(_master, EPOLLIN | EPOLLOUT);
+      return;
+    }
+    _output.erase(_output.begin(), _output.begin() + result);
+  }
+  _reactor.modify(_master, EPOLLIN);
+}
+
+SimulatedLoopback::SimulatedLoopback(Reactor& reactor, const ModuleSimulator::Options& options)
+  : LoopbackTransport(reactor, "simulated module"),
+    _simulator(reactor, options, [this](const uint8_t* data, size_t length) { deliver(data, length); })
+{
+  set_peer([this](const uint8_t* data, size_t length) { _simulator.receive(data, length); });
+}
+
+};
@@ -0,0 +1,197 @@
+// -*- C++ -*-
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <random>
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <oceanus.h>
+#include <reactor.h>
+#include <frame_parser.h>
+#include <transport.h>
+
+using namespace std;
+
+namespace Oceanus {
+
+// Simulation of an Oceanus T4B module.  Request bytes are passed to
+// receive(), response and notification frames are passed to the
+// output function after the configured latency and serialisation
+// delay, optionally with line noise.  All timing is done with timers
+// on the reactor.
+
+class ModuleSimulator
+{
+public:
+  struct Options {
+    unsigned programs = 40;
+    unsigned programs_per_ensemble = 8;
+    chrono::microseconds latency{2000};
+    map<uint16_t, chrono::microseconds> command_latency; // by command type << 8 | command
+    unsigned baud_rate = 115200;                          // 0 for no serialisation delay
+    double noise = 0;                                     // probability of a corrupted or inserted byte
+    unsigned seed = 1;
+    chrono::milliseconds tune_time{300};
+    chrono::milliseconds search_time{3000};
+    chrono::milliseconds dls_interval{5000};
+    chrono::milliseconds mot_interval{10000};
+    unsigned mot_object_size = 4096;
+  };
+
+  using output_function = function<void(const uint8_t* data, size_t length)>;
+
+  ModuleSimulator(Reactor& reactor, const Options& options, output_function output);
+  ~ModuleSimulator();
+
+  ModuleSimulator(const ModuleSimulator&) = delete;
+  ModuleSimulator& operator=(const ModuleSimulator&) = delete;
+
+  // Bytes sent by the host
+  void receive(const uint8_t* data, size_t length);
+
+  uint64_t requests() const { return _requests; }
+
+  // Parse a "COMMAND_Name=milliseconds" latency override
+  static void parse_latency(Options& options, const string& spec);
+
+private:
+  struct Program {
+    u16string name;
+    u16string ensemble;
+    uint8_t program_type;
+    uint8_t frequency_index;
+    uint8_t ecc;
+  };
+
+  enum Status {
+    Playing   = 0,
+    Searching = 1,
+    Tuning    = 2,
+    Stopped   = 3
+  };
+
+  Reactor& _reactor;
+  Options _options;
+  output_function _output;
+  FrameParser _parser;
+  mt19937 _random;
+
+  // Programs are found evenly across the Band III channels, the
+  // first _found of them are known
+  static constexpr unsigned channels = 41;
+
+  vector<Program> _database;
+  unsigned _found;
+  unsigned _search_channel;
+  Status _status;
+  uint8_t _play_mode;
+  uint32_t _play_index;
+  uint8_t _changes;
+  uint8_t _volume;
+  uint8_t _stereo_mode;
+  uint8_t _sorter;
+  uint16_t _notifications;
+  u16string _program_text;
+  unsigned _text_counter;
+  vector<uint8_t> _mot_object;
+  size_t _mot_offset;
+  unsigned _mot_counter;
+  uint64_t _requests;
+
+  Reactor::time_point _line_free;
+  set<Reactor::timer_id> _timers;
+
+  void handle(const FrameView& request);
+  void reply(const FrameView& request, const vector<uint8_t>& payload);
+  void reply_error(const FrameView& request, uint8_t error_code);
+  void send(uint8_t command_type, uint8_t command, uint8_t sequence_number, const vector<uint8_t>& payload,
+            chrono::microseconds latency);
+  void notify(uint16_t event);
+  void schedule(chrono::microseconds delay, function<void()> action);
+
+  void handle_system(const FrameView& request);
+  void handle_stream(const FrameView& request);
+  void handle_rtc(const FrameView& request);
+  void handle_mot(const FrameView& request);
+  void handle_notification(const FrameView& request);
+
+  void build_database();
+  void tune(uint8_t mode, uint32_t index);
+  void search_step(unsigned channel, unsigned last);
+  void update_text();
+  void update_mot();
+
+  static vector<uint8_t> ucs2(const u16string& text);
+  static vector<uint8_t> u32(uint32_t value);
+};
+
+// A simulated module on the master side of a new pseudo terminal.
+// The slave side is kept open so that the master does not see a
+// hangup while no host has it open.
+
+class PtyModule
+{
+public:
+  PtyModule(Reactor& reactor, const ModuleSimulator::Options& options);
+  ~PtyModule();
+
+  PtyModule(const PtyModule&) = delete;
+  PtyModule& operator=(const PtyModule&) = delete;
+
+  const string& slave_name() const { return _slave_name; }
+  uint64_t requests() const { return _simulator.requests(); }
+
+private:
+  Reactor& _reactor;
+  int _master;
+  int _slave;
+  string _slave_name;
+  deque<uint8_t> _output;
+  ModuleSimulator _simulator;
+
+  void open_pty();
+  void handle_io(uint32_t events);
+  void write(const uint8_t* data, size_t length);
+  void flush();
+};
+
+// Transports to a simulated module running on the same reactor.
+// SimulatedLoopback exercises framing, encoding and the call state
+// machine at memory speed, SimulatedPty adds the kernel tty layer.
+
+class SimulatedLoopback
+  : public LoopbackTransport
+{
+public:
+  SimulatedLoopback(Reactor& reactor, const ModuleSimulator::Options& options);
+
+  ModuleSimulator& simulator() { return _simulator; }
+
+private:
+  ModuleSimulator _simulator;
+};
+
+class SimulatedPty
+  : public PtyTransport
+{
+public:
+  SimulatedPty(Reactor& reactor, const ModuleSimulator::Options& options)
+    : SimulatedPty(reactor, make_unique<PtyModule>(reactor, options))
+  {}
+
+private:
+  SimulatedPty(Reactor& reactor, unique_ptr<PtyModule> module)
+    : PtyTransport(reactor, module->slave_name()),
+      _module(move(module))
+  {}
+
+  unique_ptr<PtyModule> _module;
+};
+
+};
@@ -1,20 +1,22 @@
 
 #include <oceanus.h>
+#include <commands.h>
+#include <state_export.h>
 
 #include <cstring>
 #include <iostream>
 #include <iomanip>
-#include <cxxabi.h>
+#include <chrono>
+#include <cassert>
+#include <algorithm>
+#include <map>
+#include <tuple>
 
-#include <sys/ioctl.h>
-#include <fcntl.h>
-#include <termios.h>
 #include <errno.h>
 #include <unistd.h>
 #include <math.h>
 
 #include <magic_enum.hpp>
-#include <nullstream.h>
 
 namespace Oceanus {
 
@@ -30,49 +32,63 @@ hexdump(ostream& os, const uint8_t* p, unsigned length) {
   os.flags(f);
 }
 
-static nullstream null;
+// Copy of a packet that outlives it, for formatting on the logger thread
+class PacketCopy
+  : public Packet
+{
+public:
+  PacketCopy(const Packet& packet)
+    : _storage(packet.buffer(), packet.buffer() + packet.length())
+  {
+    _buffer = _storage.data();
+    _length = _storage.size();
+  }
+
+private:
+  vector<uint8_t> _storage;
+};
 
-Radio::Radio(const char* const port)
-  : _port(port),
-    _fd(-1),
-    _debug(null)
+static Logger::formatter
+format_packet(const char* direction, const Packet& packet)
 {
-  open_port();
-  wait_for_readiness();
+  auto copy = make_shared<PacketCopy>(packet);
+  return [direction, copy](ostream& os) {
+    os << direction << ' ' << *copy;
+#ifdef DUMP_PACKETS
+    hexdump(os, copy->buffer(), copy->length());
+#endif
+  };
 }
 
-Radio::~Radio()
+Radio::Radio(const char* const port, Reactor& reactor)
+  : Radio(make_unique<SerialTransport>(reactor, port), reactor)
 {
-  close_port();
 }
 
-void
-Radio::open_port()
+Radio::Radio(unique_ptr<Transport> transport, Reactor& reactor)
+  : _pipeline_depth(1),
+    _transport(move(transport)),
+    _reactor(reactor),
+    _parser(Packet::max_payload),
+    _programs_version(0),
+    _next_call_id(1),
+    _limited_in_flight(0),
+    _sent_starved(false),
+    _transmitting(false)
 {
-  assert(_fd == -1);
-
-  _fd = open(_port.c_str(), O_RDWR | O_NOCTTY | O_NDELAY);
+  _transport->on_readable([this]() { handle_input(); });
+  wait_for_readiness();
+}
 
-  if (_fd == -1) {
-    throw invalid_argument((string) "Cannot open serial port: " + _port + " - " + strerror(errno));
+Radio::~Radio()
+{
+  for (auto& entry : _queued) {
+    _reactor.cancel_timer(entry.second->timer);
   }
-
-  struct termios options;
-
-  cfmakeraw(&options);
-  cfsetispeed(&options, B115200);
-  cfsetospeed(&options, B115200);
-  options.c_lflag = options.c_iflag = options.c_oflag = 0;
-  options.c_cflag = CREAD | CS8 | CLOCAL;
-  options.c_cc[VMIN] = 0;
-  options.c_cc[VTIME] = 1;
-
-  tcsetattr(_fd, TCSANOW, &options);
-
-  {
-    int status = TIOCM_RTS;
-    ioctl(_fd, TIOCMSET, &status);
+  for (auto& entry : _in_flight) {
+    _reactor.cancel_timer(entry.second->timer);
   }
+  _transport->on_readable(nullptr);
 }
 
 void
@@ -81,10 +97,11 @@ Radio::wait_for_readiness()
   int retries = _ready_retries;
   while (retries-- > 0) {
     try {
-      send_command(SYSTEM, SYSTEM_GetSysRdy);
+      call<Commands::System::GetSysRdy>();
       break;
     }
     catch (radio_timeout& timeout) {
+      _stats.ready_retry();
       if (!retries) {
         throw logic_error("No response from radio");
       }
@@ -94,92 +111,378 @@ Radio::wait_for_readiness()
 }
 
 void
-Radio::close_port()
+Radio::handle_input()
 {
-  close(_fd);
-  _fd = -1;
+  // Complete frames are taken out after every read, which leaves space
+  // for more.  A short read means that the transport has been drained.
+  size_t available;
+  size_t count;
+  do {
+    uint8_t* space = _parser.write_space(available);
+    count = _transport->read(space, available);
+    _parser.commit(count);
+    process_input();
+  } while (count && count == available);
 }
 
 void
-Radio::read(uint8_t* buffer, const unsigned length)
+Radio::process_input()
 {
-  auto start = chrono::high_resolution_clock::now();
-  unsigned remain = length;
-  uint8_t* p = buffer;
-  while (remain) {
-    int result = ::read(_fd, p, remain);
-    switch (result) {
-    case -1:
-      throw system_error(errno, generic_category(), "Error reading from serial port");
-    case 0:
-      {
-        auto now = chrono::high_resolution_clock::now();
-        auto elapsed = chrono::duration<double, milli>(now - start).count();
-        if (elapsed > _radio_timeout) {
-          throw radio_timeout();
-        }
+  uint64_t discarded = _parser.discarded();
+  FrameView frame;
+  while (_parser.next(frame)) {
+    if (_parser.discarded() != discarded) {
+      OCEANUS_LOG(LOG_DEBUG, [count = _parser.discarded() - discarded](ostream& os) {
+        os << "Skipped " << count << " bytes of invalid data";
+      });
+      discarded = _parser.discarded();
+    }
+    _flight_recorder.record(FlightRecorder::Received, frame.data, frame.length);
+    dispatch(Response::create(frame));
+  }
+  _stats.line_noise(_parser.discarded(), _parser.resyncs());
+}
+
+void
+Radio::write(const uint8_t* buffer, unsigned length)
+{
+  while (length) {
+    size_t count = _transport->write(buffer, length);
+    if (!count) {
+      OCEANUS_LOG(LOG_DEBUG, [](ostream& os) { os << "Transport busy, waiting to write"; });
+      auto deadline = Reactor::clock::now() + chrono::milliseconds(_radio_timeout);
+      if (!_transport->wait_writable(deadline)) {
+        throw radio_timeout();
       }
-      break;
-    default:
-      p += result;
-      remain -= result;
+      continue;
     }
+    buffer += count;
+    length -= count;
+  }
+}
+
+Radio::call_id
+Radio::submit(const Command& command, response_handler handler, time_point deadline, Priority priority)
+{
+  auto call = allocate_shared<Call>(PoolAllocator<Call>(_call_pool));
+  call->id = _next_call_id++;
+  call->command = command;
+  call->handler = handler;
+  call->deadline = deadline;
+  call->priority = priority;
+  call->queued = Reactor::clock::now();
+  call->timer = 0;
+  call->limited = false;
+  if (deadline != no_deadline) {
+    arm_timer(call, deadline);
   }
+  _queued[call->id] = call;
+  _queues[priority][{ deadline, call->id }] = call;
+  transmit();
+  return call->id;
 }
 
-shared_ptr<Response>
-Radio::read_response()
+void
+Radio::cancel(call_id id)
 {
-  auto response = make_shared<Response>();
-  uint8_t* buffer = response->_buffer;
+  fail_call(id, make_exception_ptr(operation_cancelled()));
+}
 
-  read(buffer, 6);
-  if (buffer[0] != 0xfe) {
-    throw logic_error("Radio response does not start with 0xFE");
+void
+Radio::arm_timer(shared_ptr<Call> call, time_point deadline, bool response_timeout)
+{
+  if (call->timer) {
+    _reactor.cancel_timer(call->timer);
   }
-  unsigned length = (buffer[4] << 8) | buffer[5];
-  read(buffer + 6, length + 1);
-  response->validate();
-  return response;
+  call_id id = call->id;
+  auto command_type = call->command.command_type;
+  auto command = call->command.command;
+  uint64_t frames = _parser.frames();
+  call->timer = _reactor.add_timer(deadline, [this, id, command_type, command, response_timeout, frames]() {
+    // If no frame has been completed since the request was sent, a
+    // partial frame has blocked the parser for the whole response
+    // timeout, probably because its length field was damaged, however
+    // much input followed it.  Otherwise, or when only a deadline
+    // expired, the partial frame may well be another call's response.
+    if (response_timeout && _parser.frames() == frames) {
+      _parser.resync();
+      process_input();
+    }
+    _stats.timed_out(command_type, command);
+    OCEANUS_LOG(LOG_WARNING, [command_type, command](ostream& os) {
+      os << "No response to " << command_name(command_type, command);
+    });
+    const uint8_t timed_out[] = { (uint8_t) command_type, command };
+    _flight_recorder.record(FlightRecorder::Timeout, timed_out, sizeof timed_out);
+    fail_call(id, make_exception_ptr(radio_timeout()));
+  });
 }
 
-shared_ptr<Response>
-Radio::send_command(CommandType command_type, uint8_t command, const vector<uint8_t>& arguments)
+void
+Radio::transmit()
 {
-  Request request(command_type, command, arguments);
+  // write() may dispatch reactor events while it waits for the port,
+  // and completion handlers may submit further calls.  The outermost
+  // invocation sends them all.
+  if (_transmitting) {
+    return;
+  }
+  _transmitting = true;
 
-  _debug << request;
-#ifdef DUMP_PACKETS
-  hexdump(_debug, request.buffer(), request.length());
-#endif
-  _debug << endl;
+  while (_in_flight.size() < _pipeline_depth) {
+    auto call = next_call();
+    if (!call) {
+      break;
+    }
+
+    Request request(call->command.command_type, call->command.command, call->command.arguments);
+
+    OCEANUS_LOG(LOG_TRACE, format_packet(">", request));
+
+    _in_flight[request.sequence_number()] = call;
+    call->sent = Reactor::clock::now();
+    auto timeout = call->sent + chrono::milliseconds(_radio_timeout);
+    arm_timer(call, min(call->deadline, timeout), timeout <= call->deadline);
+    _stats.request_sent(request.command_type(), request.command(), request.length());
+    _flight_recorder.record(FlightRecorder::Sent, request.buffer(), request.length());
+    try {
+      write(request.buffer(), request.length());
+    }
+    catch (...) {
+      fail_call(call->id, current_exception());
+    }
+  }
+
+  _transmitting = false;
+}
 
- retry:
-  if (write(_fd, request.buffer(), request.length()) != request.length()) {
-    if (errno == EAGAIN) {
-      _debug << "retry" << endl;
-      goto retry;
+shared_ptr<Radio::Call>
+Radio::next_call()
+{
+  // Regularly the first call of the highest priority, but every other
+  // call may instead be the longest starved one of a lower priority
+  auto now = Reactor::clock::now();
+  bool limited = _limited_in_flight >= max(1u, _pipeline_depth / 2);
+  int regular = -1;
+  int starved = -1;
+  for (unsigned priority = 0; priority < priorities; priority++) {
+    auto& queue = _queues[priority];
+    if (queue.empty() || (priority > TUNING && limited)) {
+      continue;
+    }
+    auto& call = queue.begin()->second;
+    if (regular < 0) {
+      regular = priority;
+    } else if (now - call->queued > priority * _aging_interval
+               && (starved < 0 || call->queued < _queues[starved].begin()->second->queued)) {
+      starved = priority;
     }
-    throw system_error(errno, generic_category(), "Could not write to serial port");
   }
+  if (regular < 0) {
+    return nullptr;
+  }
+  unsigned priority = regular;
+  if (starved >= 0 && !_sent_starved) {
+    priority = starved;
+  }
+  _sent_starved = (int) priority == starved;
 
-  shared_ptr<Response> response = read_response();
+  auto& queue = _queues[priority];
+  auto call = queue.begin()->second;
+  queue.erase(queue.begin());
+  _queued.erase(call->id);
+  call->limited = priority > TUNING;
+  _limited_in_flight += call->limited;
+  return call;
+}
+
+void
+Radio::dispatch(response_ptr response)
+{
+  OCEANUS_LOG(LOG_TRACE, format_packet("<", *response));
 
-  if (request.sequence_number() != response->sequence_number()) {
-    throw logic_error("Radio communication out of sync");
+  auto i = _in_flight.find(response->sequence_number());
+
+  // Unsolicited notifications carry an arbitrary sequence number
+  if (response->command_type() == NOTIFICATION
+      && (i == _in_flight.end() || i->second->command.command_type != NOTIFICATION)) {
+    _stats.notification_received(response->length());
+    notify(*response);
+    return;
   }
 
-  if (response) {
-    _debug << *response;
-#ifdef DUMP_PACKETS
-    hexdump(_debug, response->buffer(), response->length());
-#endif
-    _debug << endl;
+  if (i == _in_flight.end()) {
+    // Most likely a late response to a request that timed out earlier
+    OCEANUS_LOG(LOG_DEBUG, [sequence_number = response->sequence_number()](ostream& os) {
+      os << "Discarding response with unexpected sequence number " << (unsigned) sequence_number;
+    });
+    _stats.sequence_mismatch();
+    return;
+  }
+  auto call = i->second;
+  _in_flight.erase(i);
+  _limited_in_flight -= call->limited;
+  _stats.response_received(call->command.command_type, call->command.command, response->length(),
+                           response->command_type() != call->command.command_type
+                           || response->command() != call->command.command,
+                           Reactor::clock::now() - call->sent);
+  _reactor.cancel_timer(call->timer);
+  transmit();
+  call->handler(move(response), nullptr);
+  check_idle();
+}
+
+void
+Radio::notify(const Response& notification)
+{
+  uint16_t events = 0xffff;
+  if (notification.payload_length() >= 2) {
+    events = notification.payload()[0] << 8 | notification.payload()[1];
+  }
+  if (_notification_handler) {
+    _notification_handler(events);
+  }
+}
+
+void
+Radio::fail_call(call_id id, exception_ptr error)
+{
+  shared_ptr<Call> call;
+
+  auto queued = _queued.find(id);
+  if (queued != _queued.end()) {
+    call = queued->second;
+    _queued.erase(queued);
+    _queues[call->priority].erase({ call->deadline, id });
   } else {
-    _debug << "No response" << endl;
+    auto in_flight = find_if(_in_flight.begin(), _in_flight.end(), [id](const pair<const uint8_t, shared_ptr<Call>>& entry) { return entry.second->id == id; });
+    if (in_flight == _in_flight.end()) {
+      return;
+    }
+    call = in_flight->second;
+    _in_flight.erase(in_flight);
+    _limited_in_flight -= call->limited;
+  }
+
+  if (call->timer) {
+    _reactor.cancel_timer(call->timer);
+  }
+  // The handler may abandon further calls of its operation, so it runs
+  // before the freed pipeline slot is refilled
+  call->handler(nullptr, error);
+  transmit();
+  check_idle();
+}
+
+void
+Radio::check_idle()
+{
+  if (_idle_handler && !outstanding_calls()) {
+    _idle_handler();
+  }
+}
+
+void
+Radio::submit(shared_ptr<OperationState> state, const Command& command, function<void(response_ptr)> handler)
+{
+  if (state->finished) {
+    return;
+  }
+  auto on_response = [this, state, handler](response_ptr response, exception_ptr error) {
+    if (state->finished) {
+      return;
+    }
+    if (error) {
+      fail(state, error);
+      return;
+    }
+    try {
+      handler(move(response));
+    }
+    catch (...) {
+      fail(state, current_exception());
+    }
+  };
+  state->calls.push_back(submit(command, on_response, state->deadline, state->priority));
+}
+
+void
+Radio::submit_all(shared_ptr<OperationState> state, const vector<Command>& commands, function<void(vector<response_ptr>&)> handler)
+{
+  auto responses = make_shared<vector<response_ptr>>(commands.size());
+  auto remaining = make_shared<size_t>(commands.size());
+
+  if (commands.empty()) {
+    handler(*responses);
+    return;
+  }
+  for (size_t i = 0; i < commands.size(); i++) {
+    submit(state, commands[i],
+           [handler, responses, remaining, i](response_ptr response) {
+             (*responses)[i] = move(response);
+             if (--*remaining == 0) {
+               handler(*responses);
+             }
+           });
+  }
+}
+
+void
+Radio::fail(shared_ptr<OperationState> state, exception_ptr error)
+{
+  if (state->finished) {
+    return;
+  }
+  state->finished = true;
+
+  // Cancelling a call makes room in the pipeline, which must not be
+  // filled with the calls about to be cancelled
+  bool transmitting = _transmitting;
+  _transmitting = true;
+  for (auto id : state->calls) {
+    cancel(id);
   }
+  _transmitting = transmitting;
+  transmit();
+
+  state->set_exception(error);
+}
+
+Operation<response_ptr>
+Radio::async_command(const Command& command, time_point deadline)
+{
+  return start_operation<response_ptr>(deadline, [this, command](auto state) {
+    submit(state, command, [state](response_ptr response) { state->finish(move(response)); });
+  });
+}
 
-  return response;
+Operation<vector<response_ptr>>
+Radio::async_commands(const vector<Command>& commands, time_point deadline)
+{
+  return start_operation<vector<response_ptr>>(deadline, [this, commands](auto state) {
+    submit_all(state, commands, [state](vector<response_ptr>& responses) { state->finish(move(responses)); });
+  });
+}
+
+response_ptr
+Radio::send_command(CommandType command_type, uint8_t command, const Arguments& arguments)
+{
+  return wait(async_command({ command_type, command, arguments }));
+}
+
+vector<response_ptr>
+Radio::send_commands(const vector<Command>& commands)
+{
+  return wait(async_commands(commands));
+}
+
+void
+Radio::set_pipeline_depth(unsigned depth)
+{
+  if (depth < 1 || depth > _max_pipeline_depth) {
+    throw invalid_argument("Pipeline depth must be between 1 and " + to_string(_max_pipeline_depth));
+  }
+  _pipeline_depth = depth;
 }
 
 const bool
@@ -209,47 +512,78 @@ Packet::validate()
   }
 }
 
-Request::Request(CommandType command_type, uint8_t command, const vector<uint8_t>& arguments)
+// Size classes cover the common short responses, program names and
+// texts, and the occasional large MOT object
+BufferPool Response::_pool({ sizeof(Response) + 64,
+                             sizeof(Response) + 256,
+                             sizeof(Response) + 1024,
+                             sizeof(Response) + Packet::max_length },
+                           64);
+
+BufferPool Radio::_call_pool({ 128, 256, 512 }, 256);
+
+Response::Response(const FrameView& frame, uint8_t size_class)
+  : _size_class(size_class)
 {
-  assert(arguments.size() <= Packet::max_payload);
-  _buffer[0] = 0xfe;
-  _buffer[1] = command_type;
-  _buffer[2] = command;
-  _buffer[3] = _sequence_number++;
-  _buffer[4] = arguments.size() >> 8;
-  _buffer[5] = arguments.size() & 0xff;
-  unsigned p = 6;
-  for (auto i = arguments.begin(); i != arguments.end(); i++) {
-    _buffer[p++] = *i;
+  _buffer = reinterpret_cast<uint8_t*>(this + 1);
+  memcpy(_buffer, frame.data, frame.length);
+  _length = frame.length;
+}
+
+response_ptr
+Response::create(const FrameView& frame)
+{
+  uint8_t size_class;
+  void* block = _pool.allocate(sizeof(Response) + frame.length, size_class);
+  return response_ptr(new (block) Response(frame, size_class));
+}
+
+void
+ResponseDeleter::operator()(Response* response) const
+{
+  uint8_t size_class = response->_size_class;
+  response->~Response();
+  Response::_pool.release(response, size_class);
+}
+
+Arguments::Arguments(initializer_list<uint8_t> bytes)
+  : _length(0)
+{
+  append(bytes.begin(), bytes.size());
+}
+
+Arguments&
+Arguments::append(const uint8_t* bytes, unsigned length)
+{
+  if (_length + length > capacity) {
+    throw length_error("Too many request arguments");
   }
-  _buffer[p++] = 0xfd;
-  _length = p;
+  memcpy(_data + _length, bytes, length);
+  _length += length;
+  return *this;
 }
 
-static const string
-command_name(uint8_t command_type, uint8_t command)
+Request::Request(CommandType command_type, uint8_t command, const uint8_t* arguments, unsigned length)
 {
-  switch (command_type) {
-  case SYSTEM:
-    return string(magic_enum::enum_name((SYSTEM_Command) command));
-  case STREAM:
-    return string(magic_enum::enum_name((STREAM_Command) command));
-  case RTC:
-    return string(magic_enum::enum_name((RTC_Command) command));
-  case MOT:
-    return string(magic_enum::enum_name((MOT_Command) command));
-  case GPIO:
-    return string(magic_enum::enum_name((GPIO_Command) command));
-  default:
-    return "Unknown command type";
+  if (length > Arguments::capacity) {
+    throw length_error("Too many request arguments");
   }
+  _buffer = _storage;
+  _buffer[0] = 0xfe;
+  _buffer[1] = command_type;
+  _buffer[2] = command;
+  _buffer[3] = _sequence_number++;
+  _buffer[4] = length >> 8;
+  _buffer[5] = length & 0xff;
+  memcpy(_buffer + 6, arguments, length);
+  _buffer[6 + length] = 0xfd;
+  _length = 6 + length + 1;
 }
 
 ostream& operator<<(ostream& os, const Packet& packet)
 {
   const uint8_t* buffer = packet.buffer();
-  int status;
-  os << "[" << abi::__cxa_demangle(typeid(packet).name(), 0, 0, &status) << " ";
+  os << "[Packet ";
   if (packet.is_valid()) {
     os << command_name(buffer[1], buffer[2]) << " [" << packet.payload_length() << "]";
     hexdump(os, packet.buffer() + 6, packet.payload_length());
@@ -265,66 +599,216 @@ ostream& operator<<(ostream& os, const Packet& packet)
 string
 Radio::convert_string(const uint8_t* p, unsigned length)
 {
-  unsigned nchars = length / 2;
-  wchar_t buf[nchars + 1];
+  return ucs2_to_utf8(p, length);
+}
 
-  for (int i = 0; i < length; i += 2) {
-    buf[i / 2] = p[i] << 8 | p[i + 1];
+Operation<void>
+Radio::async_reset(ResetMode mode, time_point deadline)
+{
+  if (mode != REBOOT && _program_database) {
+    _reactor.post([this]() { _program_database->invalidate(); });
   }
-  buf[nchars] = 0;
-  return _wchar_to_utf8.to_bytes(buf);
+  return async_call_before<Commands::System::Reset>(deadline, mode);
 }
 
 void
 Radio::reset(ResetMode mode)
 {
-  send_command(SYSTEM, SYSTEM_Reset, { (uint8_t) mode });
+  wait(async_reset(mode));
+}
+
+Operation<void>
+Radio::async_auto_search(unsigned first_index, unsigned last_index, time_point deadline)
+{
+  return async_call_before<Commands::Stream::AutoSearch>(deadline, first_index, last_index);
 }
 
 void
 Radio::auto_search(unsigned first_index, unsigned last_index)
 {
-  send_command(STREAM, STREAM_AutoSearch, { (uint8_t) first_index, (uint8_t) last_index });
+  wait(async_auto_search(first_index, last_index));
+}
+
+Operation<vector<string>>
+Radio::async_get_programs(time_point deadline)
+{
+  return start_operation<vector<string>>(deadline, [this](auto state) {
+    submit(state, Commands::Stream::GetTotalProgram::encode(), [this, state](response_ptr response) {
+      uint32_t count = Commands::Stream::GetTotalProgram::decode(*response);
+      vector<Command> commands;
+      commands.reserve(count);
+      for (uint32_t i = 0; i < count; i++) {
+        commands.push_back(Commands::Stream::GetProgramName::encode(i));
+      }
+      submit_all(state, commands, [this, state](vector<response_ptr>& responses) {
+        vector<string> programs;
+        programs.reserve(responses.size());
+        for (auto& response : responses) {
+          programs.push_back(convert_string(response->payload(), response->payload_length()));
+        }
+        _programs = programs;
+        vector<ProgramInfo> infos(programs.size());
+        for (size_t i = 0; i < programs.size(); i++) {
+          infos[i].name = programs[i];
+        }
+        publish_programs(infos);
+        store_programs(infos);
+        state->finish(move(programs));
+      });
+    });
+  }, BACKGROUND);
 }
 
 void
 Radio::get_programs()
 {
-  auto response = send_command(STREAM, STREAM_GetTotalProgram);
-  auto payload = response->payload();
-  uint32_t count = payload[0] << 24 | payload[1] << 16 | payload[2] << 8 | payload[3];
+  wait(async_get_programs());
+}
+
+void
+Radio::set_program_database(const string& path)
+{
+  _program_database = make_unique<ProgramDatabase>(path);
+  auto identity = call<Commands::System::GetAllVersion>();
+  _module_identity.assign(identity.begin(), identity.end());
+  _program_database->load(_module_identity);
+}
+
+void
+Radio::load_programs()
+{
+  // A scan that the database does not know about changes the number
+  // of programs, so that is checked as well
+  if (_program_database && _program_database->valid()
+      && call<Commands::Stream::GetTotalProgram>() == _program_database->size()) {
+    _programs.clear();
+    for (size_t i = 0; i < _program_database->size(); i++) {
+      _programs.emplace_back(_program_database->name(i));
+    }
+    publish_programs(_program_database->programs());
+    return;
+  }
+  get_programs();
+}
+
+void
+Radio::update_programs(const vector<ProgramInfo>& programs)
+{
   _programs.clear();
-  _programs.resize(count, "");
-  for (uint32_t i = 0; i < count; i++) {
-    auto response = send_command(STREAM, STREAM_GetProgramName,
-                                 {
-                                   (uint8_t) ((i >> 24) & 0xff),
-                                     (uint8_t) ((i >> 16) & 0xff),
-                                     (uint8_t) ((i >> 8) & 0xff),
-                                     (uint8_t) (i & 0xff) });
-    _programs[i] = convert_string(response->payload(), response->payload_length());
+  for (auto& program : programs) {
+    _programs.push_back(program.name);
+  }
+  publish_programs(programs);
+  store_programs(programs);
+}
+
+void
+Radio::publish_programs(const vector<ProgramInfo>& programs)
+{
+  atomic_store(&_program_list, make_shared<const vector<ProgramInfo>>(programs));
+  _programs_version++;
+  if (_state_export) {
+    _state_export->publish(programs, _programs_version);
+  }
+  publish_state();
+}
+
+void
+Radio::export_state(const string& path)
+{
+  _state_export = make_unique<StateExport>(path);
+  if (auto programs = program_list()) {
+    _state_export->publish(*programs, _programs_version);
+  }
+  publish_state();
+}
+
+void
+Radio::publish_state()
+{
+  Snapshot snapshot = {};
+  snapshot.version = _state.version;
+  snapshot.programs_version = _programs_version;
+  snapshot.programs = _programs.size();
+  snapshot.play_status = _state.play_status;
+  snapshot.stereo = _state.stereo;
+  snapshot.sorter = _state.sorter;
+  snapshot.frequency_index = _state.frequency_index;
+  snapshot.clock = _state.clock;
+  snapshot.signal_quality = _state.signal_quality;
+  snapshot.dls_command_length = min(_state.dls_command.size(), sizeof snapshot.dls_command);
+  memcpy(snapshot.dls_command, _state.dls_command.data(), snapshot.dls_command_length);
+  copy_utf8(_state.program_name, snapshot.program_name, sizeof snapshot.program_name);
+  copy_utf8(_state.service_name, snapshot.service_name, sizeof snapshot.service_name);
+  copy_utf8(_state.program_text, snapshot.program_text, sizeof snapshot.program_text);
+  _snapshot.store(snapshot);
+  if (_state_export) {
+    _state_export->publish(snapshot);
+  }
+}
+
+void
+Radio::store_programs(const vector<ProgramInfo>& programs)
+{
+  // A list taken from the database is not written back
+  if (!_program_database || (_program_database->valid() && _program_database->programs() == programs)) {
+    return;
   }
+  try {
+    _program_database->store(_module_identity, programs);
+  }
+  catch (exception& error) {
+    OCEANUS_LOG(LOG_WARNING, [message = string(error.what())](ostream& os) { os << message; });
+  }
+}
+
+Operation<void>
+Radio::async_set_volume(uint8_t volume, time_point deadline)
+{
+  return async_call_before<Commands::Stream::SetVolume>(deadline, volume);
 }
 
 void
 Radio::set_volume(uint8_t volume)
 {
-  send_command(STREAM, STREAM_SetVolume, { volume });
+  wait(async_set_volume(volume));
+}
+
+Operation<void>
+Radio::async_set_stereo_mode(StereoMode mode, time_point deadline)
+{
+  return async_call_before<Commands::Stream::SetStereoMode>(deadline, mode);
 }
 
 void
 Radio::set_stereo_mode(StereoMode mode)
 {
-  send_command(STREAM, STREAM_SetStereoMode, { (uint8_t) mode });
+  wait(async_set_stereo_mode(mode));
+}
+
+Operation<void>
+Radio::async_play_stream(StreamPlayMode mode, uint32_t arg, time_point deadline)
+{
+  return async_call_as<Commands::Stream::Play>(TUNING, deadline, mode, arg);
 }
 
 void
 Radio::play_stream(StreamPlayMode mode, uint32_t arg)
 {
-  send_command(STREAM, STREAM_Play,
-               { (uint8_t) mode,
-                   (uint8_t) (arg >> 24), (uint8_t) ((arg >> 16) & 0xff),
-                   (uint8_t) ((arg >> 8) & 0xff), (uint8_t) (arg & 0xff)});
+  wait(async_play_stream(mode, arg));
+}
+
+Operation<void>
+Radio::async_play_dab(unsigned program_index, time_point deadline)
+{
+  return async_play_stream(DAB, program_index, deadline);
+}
+
+Operation<void>
+Radio::async_play_fm(float input_frequency, time_point deadline)
+{
+  unsigned frequency = floor(input_frequency * 1000.0);
+  return async_play_stream(FM, frequency, deadline);
 }
 
 void
@@ -336,8 +820,7 @@ Radio::play_dab(unsigned program_index)
 void
 Radio::play_fm(float input_frequency)
 {
-  unsigned frequency = floor(input_frequency * 1000.0);
-  play_stream(FM, frequency);
+  wait(async_play_fm(input_frequency));
 }
 
 void
@@ -373,76 +856,194 @@ Radio::play_linein_2()
 void
 Radio::show_status()
 {
-  cout << "Play Status: " << string(magic_enum::enum_name(_play_status)) << endl;
-  if (_program_name.length()) {
-    cout << "Program Name: " << _program_name << endl;
+  cout << "Play Status: " << string(magic_enum::enum_name(_state.play_status)) << endl;
+  if (_state.program_name.length()) {
+    cout << "Program Name: " << _state.program_name << endl;
   }
-  if (_program_text.length()) {
-    cout << "Program Text: " << _program_text << endl;
+  if (_state.program_text.length()) {
+    cout << "Program Text: " << _state.program_text << endl;
   }
 }
 
+Operation<void>
+Radio::async_set_notification(uint16_t mask, time_point deadline)
+{
+  return async_call_before<Commands::Slave::SetNotification>(deadline, mask);
+}
+
+void
+Radio::set_notification(uint16_t mask)
+{
+  wait(async_set_notification(mask));
+}
+
+Operation<void>
+Radio::async_handle_status(time_point deadline)
+{
+  return start_operation<void>(deadline, [this](auto state) {
+    submit(state, Commands::Stream::GetPlayStatus::encode(), [this, state](response_ptr response) {
+      auto [status, reserved, changes] = Commands::Stream::GetPlayStatus::decode(*response);
+      uint16_t changed = 0;
+      PlayStatus play_status = static_cast<PlayStatus>(status);
+      // The first status is reported whatever it is
+      if (play_status != _state.play_status || !_state.version) {
+        _state.play_status = play_status;
+        changed |= STATE_PlayStatus;
+        // Measured right away once playing, meaningless otherwise
+        _signal_quality_due = Reactor::clock::now();
+        if (play_status != Playing && _state.signal_quality) {
+          _state.signal_quality = 0;
+          changed |= STATE_SignalQuality;
+        }
+      }
+
+      // Fetch the flagged fields, and only those, in one pipelined batch
+      static const Command field_commands[] = {
+        Commands::Stream::GetPlayingName::encode(),
+        Commands::Stream::GetProgramText::encode(),
+        Commands::Stream::GetDLSCmd::encode(),
+        Commands::Stream::GetStereo::encode(),
+        Commands::Stream::GetServiceName::encode(),
+        Commands::Stream::GetSorter::encode(),
+        Commands::Stream::GetPlayingFrequency::encode(),
+        Commands::Rtc::GetClock::encode()
+      };
+      vector<Command> commands;
+      vector<uint16_t> fields;
+      for (unsigned bit = 0; bit < 8; bit++) {
+        if (changes & 1 << bit) {
+          commands.push_back(field_commands[bit]);
+          fields.push_back(1 << bit);
+        }
+      }
+      // The module does not flag the signal quality, so it is asked
+      // for along with the rest now and then
+      auto now = Reactor::clock::now();
+      if (play_status == Playing && now >= _signal_quality_due) {
+        commands.push_back(Commands::Stream::GetSignalQuality::encode());
+        fields.push_back(STATE_SignalQuality);
+        _signal_quality_due = now + _signal_quality_interval;
+      }
+
+      submit_all(state, commands, [this, state, fields, changed](vector<response_ptr>& responses) {
+        update_status(fields, responses, changed);
+        state->finish();
+      });
+    });
+  }, METADATA);
+}
+
 void
 Radio::handle_status()
 {
-  auto response = send_command(STREAM, STREAM_GetPlayStatus);
-  auto payload = response->payload();
-  PlayStatus play_status = static_cast<PlayStatus>(payload[0]);
-  if (play_status != _play_status) {
-    _play_status = play_status;
-    show_status();
-  }
-  if (payload[2] & 0x01) {
-    auto response = send_command(STREAM, STREAM_GetProgramName);
-    if (response->command() == STREAM_GetProgramName) {
-      _program_name = convert_string(response->payload(), response->payload_length());
-      show_status();
-    } else {
-      cout << "Cannot get program name, error code " << (unsigned) response->payload()[0];
+  wait(async_handle_status());
+}
+
+void
+Radio::update_status(const vector<uint16_t>& fields, const vector<response_ptr>& responses, uint16_t changed)
+{
+  using namespace Commands::Stream;
+
+  auto update = [&changed](auto& field, auto value, uint16_t bit) {
+    if (field != value) {
+      field = move(value);
+      changed |= bit;
     }
-  }
-  if (payload[2] & 0x02) {
-    auto response = send_command(STREAM, STREAM_GetProgramText);
-    if (response->command() == STREAM_GetProgramText) {
-      _program_text = convert_string(response->payload(), response->payload_length());
-      show_status();
-    } else {
-      cout << "Cannot get program text, error code " << (unsigned) response->payload()[0];
+  };
+  // Texts are decoded into a buffer kept across calls and swapped in
+  // only if they differ
+  auto update_text = [this, &changed](string& field, const Response& response, uint16_t bit) {
+    ucs2_to_utf8(response.payload(), response.payload_length(), _text_buffer);
+    if (_text_buffer != field) {
+      field.swap(_text_buffer);
+      changed |= bit;
+    }
+  };
+
+  for (unsigned i = 0; i < fields.size(); i++) {
+    auto& response = *responses[i];
+    try {
+      switch (fields[i]) {
+      case STATE_ProgramName:
+        if (response.command_type() != STREAM || response.command() != STREAM_GetProgramName) {
+          throw command_error(GetPlayingName::name, response.payload_length() ? response.payload()[0] : 0);
+        }
+        update_text(_state.program_name, response, STATE_ProgramName);
+        break;
+      case STATE_ProgramText:
+        // An error means that there is no text
+        if (response.command_type() != STREAM || response.command() != STREAM_GetProgramText) {
+          update(_state.program_text, string(), STATE_ProgramText);
+          break;
+        }
+        update_text(_state.program_text, response, STATE_ProgramText);
+        break;
+      case STATE_DLSCommand:
+        update(_state.dls_command, GetDLSCmd::decode(response), STATE_DLSCommand);
+        break;
+      case STATE_Stereo:
+        update(_state.stereo, GetStereo::decode(response), STATE_Stereo);
+        break;
+      case STATE_ServiceName:
+        if (response.command_type() != STREAM || response.command() != STREAM_GetServiceName) {
+          throw command_error(GetServiceName::name, response.payload_length() ? response.payload()[0] : 0);
+        }
+        update_text(_state.service_name, response, STATE_ServiceName);
+        break;
+      case STATE_Sorter:
+        update(_state.sorter, GetSorter::decode(response), STATE_Sorter);
+        break;
+      case STATE_Frequency:
+        update(_state.frequency_index, GetPlayingFrequency::decode(response), STATE_Frequency);
+        break;
+      case STATE_SignalQuality:
+        update(_state.signal_quality, GetSignalQuality::decode(response), STATE_SignalQuality);
+        break;
+      case STATE_Clock: {
+        auto [seconds, minutes, hours, day, weekday, month, year] = Commands::Rtc::GetClock::decode(response);
+        update(_state.clock, Clock{ seconds, minutes, hours, day, weekday, month, year }, STATE_Clock);
+        break;
+      }
+      }
+    }
+    catch (exception& error) {
+      // The field keeps its previous value, the module flags it again
+      // when it changes next
+      OCEANUS_LOG(LOG_WARNING, [message = string(error.what())](ostream& os) {
+        os << "Cannot update status: " << message;
+      });
     }
   }
-  if (payload[2] & 0x04) {
-    cout << "STREAM_GetDLSCmd" << endl;
-    auto response = send_command(STREAM, STREAM_GetDLSCmd);
-  }
-  if (payload[2] & 0x08) {
-    cout << "STREAM_GetStereo" << endl;
-    auto response = send_command(STREAM, STREAM_GetStereo);
-  }
-  if (payload[2] & 0x10) {
-    cout << "STREAM_GetServiceName" << endl;
-    auto response = send_command(STREAM, STREAM_GetServiceName);
-  }
-  if (payload[2] & 0x20) {
-    cout << "STREAM_GetSorter" << endl;
-    auto response = send_command(STREAM, STREAM_GetSorter);
-  }
-  if (payload[2] & 0x40) {
-    cout << "STREAM_GetFrequency" << endl;
-    auto response = send_command(STREAM, STREAM_GetFrequency);
+
+  if (!changed) {
+    return;
   }
-  if (payload[2] & 0x80) {
-    cout << "RTC_GetClock" << endl;
-    auto response = send_command(RTC, RTC_GetClock);
+  _state.version++;
+  publish_state();
+  if (_state_handler) {
+    _state_handler(_state, changed);
+  } else if (changed & (STATE_PlayStatus | STATE_ProgramName | STATE_ProgramText)) {
+    show_status();
   }
 }
 
+Operation<void>
+Radio::async_handle_mot(time_point deadline)
+{
+  return start_operation<void>(deadline, [this](auto state) {
+    submit(state, Commands::Mot::GetAppData::encode(), [state](response_ptr response) {
+      if (response->command_type() != 0x00 || response->command() != 0x02) {
+        cout << "MOT_GetAppData response: " << *response << endl;
+      }
+      state->finish();
+    });
+  }, METADATA);
+}
+
 void
 Radio::handle_mot()
 {
-  auto response = send_command(MOT, MOT_GetAppData);
-  if (response->command_type() != 0x00 || response->command() != 0x02) {
-    cout << "MOT_GetAppData response: " << *response << endl;
-  }
+  wait(async_handle_mot());
 }
 
 };
@@ -2,15 +2,34 @@
 
 #pragma once
 
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <map>
+#include <unordered_map>
 #include <string>
 #include <vector>
-#include <locale>
-#include <codecvt>
+#include <memory>
+
+#include <reactor.h>
+#include <transport.h>
+#include <frame_parser.h>
+#include <buffer_pool.h>
+#include <radio_stats.h>
+#include <flight_recorder.h>
+#include <log.h>
+#include <transcode.h>
+#include <program_database.h>
+#include <seqlock.h>
 
 using namespace std;
 
 namespace Oceanus {
 
+class StateExport;
+
 enum CommandType {
   SYSTEM       = 0x00,
   STREAM       = 0x01,
@@ -108,6 +127,32 @@ enum SLAVE_Command {
   SLAVE_GetNotification      = 0x01
 };
 
+// Notification mask bits for SLAVE_SetNotification
+enum Notification {
+  NOTIFY_ScanFinished        = 0x0001,
+  NOTIFY_NewProgramText      = 0x0002,
+  NOTIFY_Reconfiguration     = 0x0004,
+  NOTIFY_SortChanged         = 0x0008,
+  NOTIFY_RDSRawData          = 0x0010,
+  NOTIFY_NewFMProgramText    = 0x0020,
+  NOTIFY_ScanFrequency       = 0x0040
+};
+
+// Fields of Radio::State.  The low eight bits are those of the change
+// mask in the response to STREAM_GetPlayStatus.
+enum StateField {
+  STATE_ProgramName          = 0x0001,
+  STATE_ProgramText          = 0x0002,
+  STATE_DLSCommand           = 0x0004,
+  STATE_Stereo               = 0x0008,
+  STATE_ServiceName          = 0x0010,
+  STATE_Sorter               = 0x0020,
+  STATE_Frequency            = 0x0040,
+  STATE_Clock                = 0x0080,
+  STATE_PlayStatus           = 0x0100,
+  STATE_SignalQuality        = 0x0200
+};
+
 enum GPIO_Command {
   GPIO_SetFunction           = 0x00,
   GPIO_SetLevel              = 0x01,
@@ -117,6 +162,10 @@ enum GPIO_Command {
 class Packet
 {
 public:
+  Packet() = default;
+  Packet(const Packet&) = delete;
+  Packet& operator=(const Packet&) = delete;
+
   static const int max_payload = 0xF000;
 
   const uint8_t command_type() const { return _buffer[1]; };
@@ -133,50 +182,245 @@ public:
 
 protected:
   static const int max_length = 6 + max_payload + 1; // according to documentation, 6 bytes header + at most 0x101 bytes data + end byte
-  uint8_t _buffer[max_length];
+  uint8_t* _buffer;
   unsigned _length;
 };
 
 ostream& operator<<(ostream& os, const Packet& packet);
 
+// Big endian accessors for multi byte payload fields
+inline uint16_t get_u16(const uint8_t* p) { return p[0] << 8 | p[1]; }
+inline uint32_t get_u32(const uint8_t* p) { return (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]; }
+
+// Request arguments, encoded in place.  No command takes more than a
+// handful of argument bytes, so they are stored inline.
+class Arguments
+{
+public:
+  static constexpr unsigned capacity = 16;
+
+  Arguments() : _length(0) {}
+  Arguments(initializer_list<uint8_t> bytes);
+
+  Arguments& u8(uint8_t value) { return append(&value, 1); }
+  Arguments& u16(uint16_t value) { uint8_t bytes[] = { (uint8_t) (value >> 8), (uint8_t) value }; return append(bytes, 2); }
+  Arguments& u32(uint32_t value)
+  {
+    uint8_t bytes[] = { (uint8_t) (value >> 24), (uint8_t) (value >> 16), (uint8_t) (value >> 8), (uint8_t) value };
+    return append(bytes, 4);
+  }
+  Arguments& append(const uint8_t* bytes, unsigned length);
+
+  const uint8_t* data() const { return _data; }
+  unsigned size() const { return _length; }
+
+private:
+  uint8_t _data[capacity];
+  uint8_t _length;
+};
+
 class Request
   : public Packet
 {
 public:
-  Request(CommandType command_type, uint8_t command, const vector<uint8_t>& arguments);
+  Request(CommandType command_type, uint8_t command, const uint8_t* arguments, unsigned length);
+  Request(CommandType command_type, uint8_t command, const Arguments& arguments = {})
+    : Request(command_type, command, arguments.data(), arguments.size())
+  {}
 
 private:
   static uint8_t _sequence_number;
+
+  uint8_t _storage[6 + Arguments::capacity + 1];
 };
 
+class Response;
+
+struct ResponseDeleter
+{
+  void operator()(Response* response) const;
+};
+
+// Responses live in pooled blocks that are sized to the frame and are
+// returned to the pool when the handle goes away.
+using response_ptr = unique_ptr<Response, ResponseDeleter>;
+
 class Response
   : public Packet
 {
-  friend class Radio;
+public:
+  static response_ptr create(const FrameView& frame);
+
+  static uint64_t heap_allocations() { return _pool.heap_allocations(); }
+
+private:
+  friend struct ResponseDeleter;
+
+  static BufferPool _pool;
+  uint8_t _size_class;
+
+  Response(const FrameView& frame, uint8_t size_class);
+};
+
+class radio_timeout
+  : public exception
+{
+public:
+  const char* what() const noexcept override { return "No response from radio"; }
+};
+
+class operation_cancelled
+  : public exception
+{
+public:
+  const char* what() const noexcept override { return "Radio operation cancelled"; }
+};
+
+// Handle to an asynchronous radio operation.  The result becomes
+// ready when the operation has completed, failed, timed out or has
+// been cancelled.
+template <class T>
+class Operation
+{
+public:
+  Operation(future<T>&& result, function<void()> cancel)
+    : _result(move(result)),
+      _cancel(cancel)
+  {}
+
+  future<T>& result() { return _result; }
+  bool ready() const { return _result.wait_for(chrono::seconds(0)) == future_status::ready; }
+  T get() { return _result.get(); }
+
+  // Abort the operation.  Outstanding commands are abandoned and the
+  // result fails with operation_cancelled unless it is already ready.
+  void cancel() { _cancel(); }
+
+private:
+  future<T> _result;
+  function<void()> _cancel;
 };
 
 class Radio
 {
 public:
-  Radio(const char* const port);
+  Radio(const char* const port, Reactor& reactor);
+  Radio(unique_ptr<Transport> transport, Reactor& reactor);
   ~Radio();
 
+  struct Command {
+    CommandType command_type;
+    uint8_t command;
+    Arguments arguments;
+  };
+
+  using response_handler = function<void(response_ptr response, exception_ptr error)>;
+  using call_id = uint64_t;
+  using time_point = Reactor::time_point;
+  static constexpr time_point no_deadline = time_point::max();
+
+  // Queued calls are sent by priority, within one priority those with
+  // the earliest deadline first and otherwise in order of submission.
+  // A call that has waited longer than _aging_interval for each step
+  // below INTERACTIVE is starved, and every other call sent is the
+  // longest starved one if there is any.  Lower priorities thus keep
+  // moving under any load while holding up higher ones by one call at
+  // most.  Calls below TUNING may only take half of the pipeline,
+  // leaving room for the others.
+  enum Priority {
+    INTERACTIVE = 0,          // what the user is waiting for
+    TUNING      = 1,
+    METADATA    = 2,          // status and details of what is shown
+    BACKGROUND  = 3           // program lists and other bulk transfers
+  };
+
+  // Low level asynchronous interface, reactor thread only.  The
+  // handler is invoked with either the response or the error once the
+  // call has completed.  Independent of the deadline, a call fails
+  // with radio_timeout if the response does not arrive within
+  // _radio_timeout milliseconds after the request has been written.
+  call_id submit(const Command& command, response_handler handler, time_point deadline = no_deadline,
+                 Priority priority = INTERACTIVE);
+  void cancel(call_id id);
+
+  // Asynchronous operations.  These may be called from any thread.
+  // They are executed on the reactor thread, so the reactor must be
+  // running for them to make progress.
+  Operation<response_ptr> async_command(const Command& command, time_point deadline = no_deadline);
+  Operation<vector<response_ptr>> async_commands(const vector<Command>& commands, time_point deadline = no_deadline);
+
   enum ResetMode {
     REBOOT                    = 0x00,
     CLEAR_DATABASE_AND_REBOOT = 0x01,
     CLEAR_DATABASE            = 0x02
   };
+  Operation<void> async_reset(ResetMode mode, time_point deadline = no_deadline);
+  Operation<void> async_auto_search(unsigned first_index, unsigned last_index, time_point deadline = no_deadline);
+  Operation<vector<string>> async_get_programs(time_point deadline = no_deadline);
+  Operation<void> async_set_volume(uint8_t volume, time_point deadline = no_deadline);
+
+  enum StereoMode {
+    FORCE_MONO         = 0,
+    AUTO_DETECT_STEREO = 1
+  };
+  Operation<void> async_set_stereo_mode(StereoMode mode, time_point deadline = no_deadline);
+
+  Operation<void> async_play_fm(float frequency, time_point deadline = no_deadline);
+  Operation<void> async_play_dab(unsigned program_index, time_point deadline = no_deadline);
+
+  // Enable unsolicited notification frames for the events in mask,
+  // see enum Notification.  Notifications are passed to the handler
+  // on the reactor thread.  If the module does not say which events
+  // occurred, the handler is called with all bits set.
+  using notification_handler = function<void(uint16_t events)>;
+  void on_notification(notification_handler handler) { _notification_handler = handler; }
+  Operation<void> async_set_notification(uint16_t mask, time_point deadline = no_deadline);
+
+  // Called whenever the last outstanding call has finished, for work
+  // that should only use an otherwise idle link
+  using idle_handler = function<void()>;
+  void on_idle(idle_handler handler) { _idle_handler = handler; }
+
+  // Fetch the play status and those fields of the state that the
+  // module has flagged as changed, in a single batch
+  Operation<void> async_handle_status(time_point deadline = no_deadline);
+  Operation<void> async_handle_mot(time_point deadline = no_deadline);
+
+  // Typed interface.  C is a command descriptor from commands.h, for
+  // example Commands::Stream::GetTotalProgram, and the arguments and
+  // result are checked against its layout at compile time.
+  template <class C, class... Args>
+  typename C::result call(const Args&... args);
+  template <class C, class... Args>
+  Operation<typename C::result> async_call(const Args&... args) { return async_call_before<C>(no_deadline, args...); }
+  template <class C, class... Args>
+  Operation<typename C::result> async_call_before(time_point deadline, const Args&... args)
+  {
+    return async_call_as<C>(INTERACTIVE, deadline, args...);
+  }
+  template <class C, class... Args>
+  Operation<typename C::result> async_call_as(Priority priority, time_point deadline, const Args&... args);
+
+  // Blocking interface.  When called on the reactor thread, these
+  // dispatch reactor events until the operation has completed.
   void reset(ResetMode mode);
   void auto_search(unsigned first_index, unsigned last_index);
   vector<string> _programs;
   void get_programs();
 
+  // Keep the program list in a database file, see ProgramDatabase.
+  // load_programs() then takes _programs from the file and only asks
+  // the module for them if the file does not match it.  The database
+  // is updated whenever the programs are fetched and forgotten when
+  // the module's database is cleared.
+  void set_program_database(const string& path);
+  void load_programs();
+  // Set _programs to programs obtained otherwise, see ProgramCatalogue
+  void update_programs(const vector<ProgramInfo>& programs);
+  const ProgramDatabase* program_database() const { return _program_database.get(); }
+
   void set_volume(uint8_t volume);
 
-  enum StereoMode {
-    FORCE_MONO         = 0,
-    AUTO_DETECT_STEREO = 1
-  };
   void set_stereo_mode(StereoMode mode);
 
   void play_fm(float frequency);
@@ -187,12 +431,13 @@ public:
   void play_linein_1();
   void play_linein_2();
 
+  void set_notification(uint16_t mask);
+
   void handle_status();
   void handle_mot();
 
   void show_status();
 
-  wstring_convert<codecvt_utf8<wchar_t>> _wchar_to_utf8;
   string convert_string(const uint8_t* buf, unsigned length);
 
   enum PlayStatus {
@@ -201,29 +446,189 @@ public:
     Tuning    = 2,
     Stop      = 3
   };
-  PlayStatus get_play_status() const { return _play_status; }
+  PlayStatus get_play_status() const { return _state.play_status; }
+
+  struct Clock {
+    uint8_t seconds, minutes, hours, day, weekday, month, year;
+
+    bool operator==(const Clock& other) const { return memcmp(this, &other, sizeof *this) == 0; }
+    bool operator!=(const Clock& other) const { return !(*this == other); }
+  };
+
+  // The module's state as of the last handle_status().  version is
+  // incremented whenever a field changes.
+  struct State {
+    uint64_t version = 0;
+    PlayStatus play_status = Stop;
+    string program_name;
+    string program_text;
+    vector<uint8_t> dls_command;
+    uint8_t stereo = 0;
+    string service_name;
+    uint8_t sorter = 0;
+    uint8_t frequency_index = 0;
+    Clock clock = {};
+    uint8_t signal_quality = 0;     // while playing, see _signal_quality_interval
+  };
+  const State& state() const { return _state; }
+
+  // A copy of the state for other threads, with texts truncated to
+  // fixed size buffers of NUL terminated UTF-8
+  struct Snapshot {
+    uint64_t version;               // of the State
+    uint64_t programs_version;      // incremented when the program list changes
+    uint32_t programs;              // in the program list
+    uint8_t play_status;
+    uint8_t stereo;
+    uint8_t sorter;
+    uint8_t frequency_index;
+    Clock clock;
+    uint8_t signal_quality;
+    uint8_t dls_command_length;
+    uint8_t dls_command[32];
+    char program_name[64];
+    char service_name[64];
+    char program_text[512];
+  };
+
+  // Readable from any thread without waiting for the reactor thread,
+  // which publishes new snapshots and program lists whenever they
+  // change.  Snapshots are read without locking.  The program list
+  // pointer is swapped with the shared_ptr atomics, which libstdc++
+  // implements with a short spinlock, so a reader may briefly wait
+  // for another thread copying the pointer, never for the reactor to
+  // build a list.  The snapshot and the list may be a change apart;
+  // programs_version tells which list a snapshot goes with.
+  Snapshot snapshot() const { return _snapshot.load(); }
+  uint64_t snapshot_stores() const { return _snapshot.stores(); }
+  shared_ptr<const vector<ProgramInfo>> program_list() const { return atomic_load(&_program_list); }
+
+  // Also publish the snapshots and the program list to other
+  // processes, in a shared memory segment at path, see StateExport
+  void export_state(const string& path);
+
+  // Called on the reactor thread with the state and the StateFields
+  // that have changed, at most once per handle_status().  Without a
+  // handler, changes of the play status, program name and text are
+  // shown with show_status().
+  using state_handler = function<void(const State& state, uint16_t changed)>;
+  void on_state_change(state_handler handler) { _state_handler = handler; }
+
+  // Number of requests that may be outstanding at the same time.
+  // Responses are matched to their requests by sequence number.
+  void set_pipeline_depth(unsigned depth);
+  unsigned get_pipeline_depth() const { return _pipeline_depth; }
+
+  // Calls submitted and not yet completed
+  size_t outstanding_calls() const { return _queued.size() + _in_flight.size(); }
+  size_t queued_calls(Priority priority) const { return _queues[priority].size(); }
+
+  // Line noise statistics
+  uint64_t get_discarded_bytes() const { return _parser.discarded(); }
+  uint64_t get_resyncs() const { return _parser.resyncs(); }
+
+  // Per command latencies and counters, readable from any thread
+  const RadioStats& stats() const { return _stats; }
+
+  // The most recent frames sent and received
+  FlightRecorder& flight_recorder() { return _flight_recorder; }
 
 private:
   const unsigned _radio_timeout = 500;
   const unsigned _ready_retries = 5;
+  const unsigned _max_pipeline_depth = 128;
+  const chrono::seconds _signal_quality_interval{1};
+  const chrono::milliseconds _aging_interval{100};
+
+  unsigned _pipeline_depth;
+
+  unique_ptr<Transport> _transport;
+
+  Reactor& _reactor;
+  FrameParser _parser;
+
+  State _state;
+  string _text_buffer;              // decoded into before comparing
+  state_handler _state_handler;
+  Reactor::time_point _signal_quality_due;
+  uint64_t _programs_version;
+  SeqLock<Snapshot> _snapshot;
+  shared_ptr<const vector<ProgramInfo>> _program_list;
+  unique_ptr<StateExport> _state_export;
+
+  struct Call {
+    call_id id;
+    Command command;
+    response_handler handler;
+    time_point deadline;
+    Priority priority;
+    time_point queued;
+    time_point sent;
+    Reactor::timer_id timer;
+    bool limited;             // takes one of the pipeline slots below TUNING
+  };
+
+  static const unsigned priorities = BACKGROUND + 1;
+
+  // Calls and operation states, with their promises, are recycled
+  // like responses
+  static BufferPool _call_pool;
+
+  call_id _next_call_id;
+  unordered_map<call_id, shared_ptr<Call>> _queued;
+  map<pair<time_point, call_id>, shared_ptr<Call>> _queues[priorities];   // by deadline and id
+  map<uint8_t, shared_ptr<Call>> _in_flight; // by sequence number
+  unsigned _limited_in_flight;
+  bool _sent_starved;         // the last call sent was not the regular choice
+  bool _transmitting;
+
+  notification_handler _notification_handler;
+  idle_handler _idle_handler;
 
-  const string _port;
-  int _fd;
+  RadioStats _stats;
+  FlightRecorder _flight_recorder;
 
-  ostream& _debug;
+  unique_ptr<ProgramDatabase> _program_database;
+  string _module_identity;
 
-  PlayStatus _play_status;
-  string _program_name;
-  string _program_text;
+  // Bookkeeping shared by the calls making up one asynchronous operation
+  struct OperationState {
+    virtual ~OperationState() {}
+    virtual void set_exception(exception_ptr error) = 0;
+
+    time_point deadline;
+    Priority priority = INTERACTIVE;
+    vector<call_id> calls;
+    bool finished = false;
+  };
+  template <class T> struct OperationResult;
+
+  template <class T>
+  Operation<T> start_operation(time_point deadline, function<void(shared_ptr<OperationResult<T>>)> start,
+                               Priority priority = INTERACTIVE);
+  void submit(shared_ptr<OperationState> state, const Command& command, function<void(response_ptr)> handler);
+  void submit_all(shared_ptr<OperationState> state, const vector<Command>& commands, function<void(vector<response_ptr>&)> handler);
+  void fail(shared_ptr<OperationState> state, exception_ptr error);
+
+  template <class T>
+  T wait(Operation<T>&& operation);
 
-  void open_port();
   void wait_for_readiness();
-  void close_port();
 
-  void read(uint8_t* buffer, const unsigned length);
+  void handle_input();
+  void process_input();
+  void write(const uint8_t* buffer, unsigned length);
+
+  void transmit();
+  shared_ptr<Call> next_call();
+  void dispatch(response_ptr response);
+  void notify(const Response& notification);
+  void fail_call(call_id id, exception_ptr error);
+  void check_idle();
+  void arm_timer(shared_ptr<Call> call, time_point deadline, bool response_timeout = false);
 
-  shared_ptr<Response> send_command(CommandType command_type, uint8_t command, const vector<uint8_t>& arguments = {});
-  shared_ptr<Response> read_response();
+  response_ptr send_command(CommandType command_type, uint8_t command, const Arguments& arguments = {});
+  vector<response_ptr> send_commands(const vector<Command>& commands);
 
   enum StreamPlayMode {
     DAB         = 0x00,
@@ -235,12 +640,91 @@ private:
     LINEIN_2    = 0x07
   };
 
+  Operation<void> async_play_stream(StreamPlayMode mode, uint32_t arg, time_point deadline = no_deadline);
   void play_stream(StreamPlayMode mode, uint32_t arg);
+  void update_status(const vector<uint16_t>& fields, const vector<response_ptr>& responses, uint16_t changed);
+  void store_programs(const vector<ProgramInfo>& programs);
+  void publish_programs(const vector<ProgramInfo>& programs);
+  void publish_state();
+};
 
-  class radio_timeout
-    : public exception
+template <class T>
+struct Radio::OperationResult
+  : public Radio::OperationState
+{
+  promise<T> result;
+
+  OperationResult() : result(allocator_arg, PoolAllocator<char>(_call_pool)) {}
+
+  void set_exception(exception_ptr error) override { result.set_exception(error); }
+
+  template <class... Value>
+  void finish(Value&&... value)
   {
-  };
+    if (!finished) {
+      finished = true;
+      result.set_value(forward<Value>(value)...);
+    }
+  }
 };
 
+template <class T>
+Operation<T>
+Radio::start_operation(time_point deadline, function<void(shared_ptr<OperationResult<T>>)> start, Priority priority)
+{
+  auto state = allocate_shared<OperationResult<T>>(PoolAllocator<OperationResult<T>>(_call_pool));
+  state->deadline = deadline;
+  state->priority = priority;
+
+  Operation<T> operation(state->result.get_future(),
+                         [this, state]() {
+                           _reactor.post([this, state]() { fail(state, make_exception_ptr(operation_cancelled())); });
+                         });
+
+  _reactor.post([this, state, start]() {
+    try {
+      start(state);
+    }
+    catch (...) {
+      fail(state, current_exception());
+    }
+  });
+
+  return operation;
+}
+
+template <class T>
+T
+Radio::wait(Operation<T>&& operation)
+{
+  if (!_reactor.running_in_other_thread()) {
+    _reactor.run_until([&operation]() { return operation.ready(); });
+  }
+  return operation.get();
+}
+
+template <class C, class... Args>
+typename C::result
+Radio::call(const Args&... args)
+{
+  return wait(async_call<C>(args...));
+}
+
+template <class C, class... Args>
+Operation<typename C::result>
+Radio::async_call_as(Priority priority, time_point deadline, const Args&... args)
+{
+  Command command = C::encode(args...);
+  return start_operation<typename C::result>(deadline, [this, command](auto state) {
+    submit(state, command, [state](response_ptr response) {
+      if constexpr (is_void<typename C::result>::value) {
+        C::decode(*response);
+        state->finish();
+      } else {
+        state->finish(C::decode(*response));
+      }
+    });
+  }, priority);
+}
+
 };
@@ -0,0 +1,356 @@
+#include <program_catalogue.h>
+#include <commands.h>
+
+namespace Oceanus {
+
+ProgramCatalogue::ProgramCatalogue(Radio& radio, Reactor& reactor)
+  : _radio(radio),
+    _reactor(reactor),
+    _index(nullptr),
+    _source(0),
+    _loaded(false),
+    _missing_names(0),
+    _missing_details(0),
+    _next_background(0),
+    _calls(radio),
+    _retry_timer(0)
+{
+  _radio.on_idle([this]() { pump(); });
+}
+
+ProgramCatalogue::~ProgramCatalogue()
+{
+  _radio.on_idle(nullptr);
+  cancel_calls();
+}
+
+void
+ProgramCatalogue::set_index(ServiceIndex* index, unsigned source)
+{
+  _index = index;
+  _source = source;
+  if (_index) {
+    _index->remove_source(_source);
+    for (size_t i = 0; i < _programs.size(); i++) {
+      if (_names[i] == Resolved) {
+        _index->set(_source, i, _programs[i]);
+      }
+    }
+  }
+}
+
+void
+ProgramCatalogue::cancel_calls()
+{
+  _reactor.cancel_timer(_retry_timer);
+  _retry_timer = 0;
+  _calls.cancel();
+}
+
+void
+ProgramCatalogue::refresh()
+{
+  // Before cancelling, as the radio may call pump() once it is idle
+  _loaded = false;
+  cancel_calls();
+  _programs.clear();
+  _names.clear();
+  _details.clear();
+  _missing_names = 0;
+  _missing_details = 0;
+  _focus.clear();
+  if (_index) {
+    _index->remove_source(_source);
+  }
+  changed(npos);
+
+  _calls.submit(Commands::Stream::GetTotalProgram::encode(), [this](response_ptr response, exception_ptr error) {
+    try {
+      if (error) {
+        rethrow_exception(error);
+      }
+      load(Commands::Stream::GetTotalProgram::decode(*response));
+    }
+    catch (exception& error) {
+      OCEANUS_LOG(LOG_WARNING, [message = string(error.what())](ostream& os) {
+        os << "Cannot get the number of programs: " << message;
+      });
+      retry_later([this]() { refresh(); });
+    }
+  }, Radio::METADATA);
+}
+
+void
+ProgramCatalogue::load(uint32_t count)
+{
+  auto database = _radio.program_database();
+  if (database && database->valid() && database->size() == count) {
+    _programs = database->programs();
+    _names.assign(count, Resolved);
+    _details.resize(count);
+    for (size_t i = 0; i < count; i++) {
+      _details[i] = _programs[i].details ? Resolved : Missing;
+      _missing_details += !_programs[i].details;
+      if (_index) {
+        _index->set(_source, i, _programs[i]);
+      }
+    }
+    // Makes it the radio's list, the database already has it
+    _radio.update_programs(_programs);
+  } else {
+    _programs.assign(count, ProgramInfo());
+    _names.assign(count, Missing);
+    _details.assign(count, Missing);
+    _missing_names = count;
+    _missing_details = count;
+  }
+  _next_background = 0;
+  _loaded = true;
+  changed(npos);
+  pump();
+}
+
+void
+ProgramCatalogue::extend(size_t count)
+{
+  if (!_loaded || count == _programs.size()) {
+    return;
+  }
+  if (count < _programs.size()) {
+    refresh();
+    return;
+  }
+  size_t first = _programs.size();
+  _programs.resize(count);
+  _names.resize(count, Missing);
+  _details.resize(count, Missing);
+  _missing_names += count - first;
+  _missing_details += count - first;
+  for (size_t i = first; i < count; i++) {
+    _focus.push_back(i);
+  }
+  changed(npos);
+  pump();
+}
+
+void
+ProgramCatalogue::update()
+{
+  if (!_loaded) {
+    refresh();
+    return;
+  }
+  _calls.submit(Commands::Stream::GetTotalProgram::encode(), [this](response_ptr response, exception_ptr error) {
+    try {
+      if (error) {
+        rethrow_exception(error);
+      }
+      extend(Commands::Stream::GetTotalProgram::decode(*response));
+    }
+    catch (exception& error) {
+      OCEANUS_LOG(LOG_WARNING, [message = string(error.what())](ostream& os) {
+        os << "Cannot get the number of programs: " << message;
+      });
+    }
+  }, Radio::METADATA);
+}
+
+const string&
+ProgramCatalogue::name(size_t index)
+{
+  if (index < _names.size() && _names[index] == Missing) {
+    _focus.push_front(index);
+    pump();
+  }
+  return _programs.at(index).name;
+}
+
+const ProgramInfo&
+ProgramCatalogue::program(size_t index)
+{
+  if (index < _names.size() && (_names[index] == Missing || _details[index] == Missing)) {
+    _focus.push_front(index);
+    pump();
+  }
+  return _programs.at(index);
+}
+
+void
+ProgramCatalogue::focus(size_t index, size_t span)
+{
+  // Queued in front of older focus requests, nearest to index first.
+  // Before the list has loaded, the indexes are kept until it has.
+  for (size_t distance = span + 1; distance-- > 0; ) {
+    _focus.push_front(index + distance);
+    if (distance && index >= distance) {
+      _focus.push_front(index - distance);
+    }
+  }
+  pump();
+}
+
+bool
+ProgramCatalogue::next_focus(size_t& index)
+{
+  while (!_focus.empty()) {
+    index = _focus.front();
+    _focus.pop_front();
+    if (index < _names.size() && (_names[index] == Missing || _details[index] == Missing)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool
+ProgramCatalogue::next_background(vector<State>& states, size_t& index)
+{
+  // What failed is retried on the next pass
+  for (size_t n = 0; n < states.size(); n++) {
+    index = _next_background;
+    _next_background = (_next_background + 1) % states.size();
+    if (states[index] == Missing) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void
+ProgramCatalogue::pump()
+{
+  if (!_loaded) {
+    return;
+  }
+  size_t index;
+  while (_calls.size() < _max_focus_calls && next_focus(index)) {
+    if (_names[index] == Missing) {
+      request_name(index, Radio::METADATA);
+    }
+    if (_details[index] == Missing) {
+      request_details(index, Radio::METADATA);
+    }
+  }
+  // The link is idle when only our own calls are outstanding, and
+  // the radio calls back when it becomes idle.  All names come before
+  // any further details.
+  while (_calls.size() < _max_background_calls && _radio.outstanding_calls() == _calls.size()) {
+    if (_missing_names && next_background(_names, index)) {
+      request_name(index, Radio::BACKGROUND);
+    } else if (_missing_details && next_background(_details, index)) {
+      request_details(index, Radio::BACKGROUND);
+    } else {
+      break;
+    }
+  }
+}
+
+void
+ProgramCatalogue::retry_later(function<void()> action)
+{
+  if (!_retry_timer) {
+    _retry_timer = _reactor.add_timer(Reactor::clock::now() + _retry_delay, [this, action]() {
+      _retry_timer = 0;
+      action();
+    });
+  }
+}
+
+void
+ProgramCatalogue::request_name(size_t index, Radio::Priority priority)
+{
+  _names[index] = Requested;
+  auto command = Commands::Stream::GetProgramName::encode(index);
+  _calls.submit(command, [this, index](response_ptr response, exception_ptr error) {
+    if (!error) {
+      try {
+        _programs[index].name = Commands::Stream::GetProgramName::decode(*response);
+      }
+      catch (command_error&) {
+        // The module has no name for it, leave it empty
+      }
+      catch (exception&) {
+        error = current_exception();
+      }
+    }
+    if (error) {
+      // Most likely line noise, try again later
+      _names[index] = Missing;
+      retry_later([this]() { pump(); });
+      return;
+    }
+    finish(_names, _missing_names, index);
+    pump();
+  }, priority);
+}
+
+void
+ProgramCatalogue::request_details(size_t index, Radio::Priority priority)
+{
+  using namespace Commands::Stream;
+
+  // The details take one command each and are recorded once all have
+  // been answered.  What the module does not know is left zero.
+  auto info = make_shared<ProgramInfo>();
+  auto known = [](auto decode) {
+    return [decode](const Response& response) {
+      try {
+        decode(response);
+      }
+      catch (command_error&) {
+      }
+    };
+  };
+
+  _details[index] = Requested;
+  _calls.submit_batch({
+      { GetEnsembleName::encode(index),
+        known([info](const Response& response) { info->ensemble = GetEnsembleName::decode(response); }) },
+      { GetProgramType::encode(index),
+        known([info](const Response& response) { info->program_type = GetProgramType::decode(response); }) },
+      { GetFrequency::encode(index),
+        known([info](const Response& response) { info->frequency_index = GetFrequency::decode(response); }) },
+      { GetECC::encode(index),
+        known([info](const Response& response) { tie(info->ecc, info->country) = GetECC::decode(response); }) }
+    }, [this, index, info](bool succeeded) {
+      if (!succeeded) {
+        _details[index] = Missing;
+        retry_later([this]() { pump(); });
+        return;
+      }
+      auto& program = _programs[index];
+      program.ensemble = move(info->ensemble);
+      program.program_type = info->program_type;
+      program.frequency_index = info->frequency_index;
+      program.ecc = info->ecc;
+      program.country = info->country;
+      program.details = true;
+      finish(_details, _missing_details, index);
+      pump();
+    }, priority);
+}
+
+void
+ProgramCatalogue::finish(vector<State>& states, size_t& missing, size_t index)
+{
+  states[index] = Resolved;
+  missing--;
+  if (_index) {
+    _index->set(_source, index, _programs[index]);
+  }
+  changed(index);
+  // Stored when the names are complete, and again with the details
+  if (!missing && !_missing_names) {
+    _radio.update_programs(_programs);
+  }
+}
+
+void
+ProgramCatalogue::changed(size_t index)
+{
+  if (_change_handler) {
+    _change_handler(index);
+  }
+}
+
+};
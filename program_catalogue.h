@@ -0,0 +1,124 @@
+// -*- C++ -*-
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <call_group.h>
+#include <oceanus.h>
+#include <service_index.h>
+
+using namespace std;
+
+namespace Oceanus {
+
+// The module's program list with names and details resolved on
+// demand.  refresh() only asks for the number of programs, so the list
+// is usable after a single command.  Names and details (ensemble,
+// programme type, frequency and country) are then fetched in the
+// background: first for the programs around the focus, which a user
+// interface sets to the program being played and the ones it
+// displays, then all names and after them all details while the link
+// is otherwise idle.  Completed lists are handed to
+// Radio::update_programs(), which stores them in the program database;
+// if the database already matches the module, nothing is fetched.
+//
+// Reactor thread only.
+
+class ProgramCatalogue
+{
+public:
+  ProgramCatalogue(Radio& radio, Reactor& reactor);
+  ~ProgramCatalogue();
+
+  ProgramCatalogue(const ProgramCatalogue&) = delete;
+  ProgramCatalogue& operator=(const ProgramCatalogue&) = delete;
+
+  // Keep the index up to date with the programs, as those of the
+  // given source.  Several catalogues may share an index.
+  void set_index(ServiceIndex* index, unsigned source = 0);
+
+  // Start over with the module's current program list
+  void refresh();
+
+  // The module has found more programs, as during a scan.  The new
+  // ones are fetched before other missing ones.  A shorter list means
+  // that the module's list has changed altogether and is loaded again.
+  void extend(size_t count);
+  // Ask the module for its number of programs and extend to it
+  void update();
+
+  // A program without focusing on it
+  const ProgramInfo& peek(size_t index) const { return _programs.at(index); }
+
+  // False until the number of programs is known
+  bool loaded() const { return _loaded; }
+  bool complete() const { return _loaded && _missing_names == 0 && _missing_details == 0; }
+  size_t size() const { return _programs.size(); }
+
+  // A program's name, empty until it has been fetched, and its other
+  // details, valid once info.details is set.  Asking for missing ones
+  // focuses on them.
+  bool resolved(size_t index) const { return index < _names.size() && _names[index] == Resolved; }
+  const string& name(size_t index);
+  const ProgramInfo& program(size_t index);
+
+  // Fetch the programs from index - span to index + span before any
+  // others, nearest first
+  void focus(size_t index, size_t span = 8);
+
+  // Called with the index of each program as its name or details
+  // arrive, and with npos when the list has been loaded or emptied
+  static constexpr size_t npos = ~(size_t) 0;
+  using change_handler = function<void(size_t index)>;
+  void on_change(change_handler handler) { _change_handler = handler; }
+
+private:
+  // Calls for focused programs made at the same time, background
+  // calls only when nothing else is outstanding
+  const size_t _max_focus_calls = 8;
+  const size_t _max_background_calls = 1;
+  const chrono::milliseconds _retry_delay{5};     // after a failed call
+
+  enum State : uint8_t {
+    Missing,
+    Requested,
+    Resolved
+  };
+
+  Radio& _radio;
+  Reactor& _reactor;
+  ServiceIndex* _index;
+  unsigned _source;
+
+  bool _loaded;
+  vector<ProgramInfo> _programs;
+  vector<State> _names;
+  vector<State> _details;
+  size_t _missing_names;
+  size_t _missing_details;
+
+  deque<size_t> _focus;
+  size_t _next_background;
+  CallGroup _calls;           // cancelled by refresh()
+  Reactor::timer_id _retry_timer;
+
+  change_handler _change_handler;
+
+  void cancel_calls();
+  void load(uint32_t count);
+  void pump();
+  void retry_later(function<void()> action);
+  bool next_focus(size_t& index);
+  bool next_background(vector<State>& states, size_t& index);
+  void request_name(size_t index, Radio::Priority priority);
+  void request_details(size_t index, Radio::Priority priority);
+  void finish(vector<State>& states, size_t& missing, size_t index);
+  void changed(size_t index);
+};
+
+};
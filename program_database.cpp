@@ -0,0 +1,177 @@
+#include <program_database.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Oceanus {
+
+ProgramDatabase::ProgramDatabase(const string& path)
+  : _path(path),
+    _generation(0),
+    _header(nullptr),
+    _length(0)
+{
+}
+
+ProgramDatabase::~ProgramDatabase()
+{
+  unmap();
+}
+
+void
+ProgramDatabase::unmap()
+{
+  if (_header) {
+    munmap(const_cast<FileHeader*>(_header), _length);
+    _header = nullptr;
+    _length = 0;
+  }
+}
+
+bool
+ProgramDatabase::load(const string& identity)
+{
+  unmap();
+
+  int fd = open(_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat status;
+  void* map = MAP_FAILED;
+  if (fstat(fd, &status) == 0 && (size_t) status.st_size >= sizeof(FileHeader)) {
+    map = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+  _header = static_cast<const FileHeader*>(map);
+  _length = status.st_size;
+
+  // Check everything once here, so that the accessors need not
+  auto contains = [this](uint64_t offset, uint64_t length) { return offset <= _length && length <= _length - offset; };
+  auto base = reinterpret_cast<const char*>(_header);
+  bool intact = !memcmp(_header->magic, magic, sizeof magic) && _header->version == version
+    && _header->length == _length
+    && contains(sizeof(FileHeader), (uint64_t) _header->count * sizeof(Entry))
+    && contains(_header->identity_offset, _header->identity_length);
+  auto entries = reinterpret_cast<const Entry*>(_header + 1);
+  for (uint32_t i = 0; intact && i < _header->count; i++) {
+    intact = contains(entries[i].name_offset, entries[i].name_length)
+      && contains(entries[i].ensemble_offset, entries[i].ensemble_length);
+  }
+  if (intact) {
+    _generation = _header->generation;
+  }
+  if (!intact || string_view(base + _header->identity_offset, _header->identity_length) != identity) {
+    unmap();
+    return false;
+  }
+  return true;
+}
+
+void
+ProgramDatabase::store(const string& identity, const vector<ProgramInfo>& programs)
+{
+  FileHeader header = {};
+  memcpy(header.magic, magic, sizeof magic);
+  header.version = version;
+  header.count = programs.size();
+  header.generation = _generation + 1;
+  header.identity_offset = sizeof header + programs.size() * sizeof(Entry);
+  header.identity_length = identity.size();
+
+  vector<Entry> entries(programs.size());
+  uint64_t offset = header.identity_offset + identity.size();
+  for (size_t i = 0; i < programs.size(); i++) {
+    auto& program = programs[i];
+    auto& entry = entries[i];
+    entry.name_offset = offset;
+    entry.name_length = program.name.size();
+    offset += program.name.size();
+    entry.ensemble_offset = offset;
+    entry.ensemble_length = program.ensemble.size();
+    offset += program.ensemble.size();
+    entry.program_type = program.program_type;
+    entry.frequency_index = program.frequency_index;
+    entry.ecc = program.ecc;
+    entry.country = program.country;
+    entry.flags = program.details ? Details : 0;
+  }
+  header.length = offset;
+
+  // Write a new file and rename it over the old one, which may still
+  // be mapped by this or another process
+  string temporary = _path + ".new";
+  {
+    ofstream file(temporary, ios::binary | ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof header);
+    file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(Entry));
+    file.write(identity.data(), identity.size());
+    for (auto& program : programs) {
+      file.write(program.name.data(), program.name.size());
+      file.write(program.ensemble.data(), program.ensemble.size());
+    }
+    if (!file.flush()) {
+      throw runtime_error("Cannot write program database " + temporary);
+    }
+  }
+  if (rename(temporary.c_str(), _path.c_str()) < 0) {
+    throw runtime_error("Cannot replace program database " + _path + ": " + strerror(errno));
+  }
+  _generation = header.generation;
+
+  if (!load(identity)) {
+    throw runtime_error("Program database " + _path + " changed while it was written");
+  }
+}
+
+void
+ProgramDatabase::invalidate()
+{
+  unmap();
+  unlink(_path.c_str());
+}
+
+string_view
+ProgramDatabase::name(size_t index) const
+{
+  return text(entry(index).name_offset, entry(index).name_length);
+}
+
+ProgramInfo
+ProgramDatabase::program(size_t index) const
+{
+  auto& entry = this->entry(index);
+  ProgramInfo program;
+  program.name = text(entry.name_offset, entry.name_length);
+  program.ensemble = text(entry.ensemble_offset, entry.ensemble_length);
+  program.program_type = entry.program_type;
+  program.frequency_index = entry.frequency_index;
+  program.ecc = entry.ecc;
+  program.country = entry.country;
+  program.details = entry.flags & Details;
+  return program;
+}
+
+vector<ProgramInfo>
+ProgramDatabase::programs() const
+{
+  vector<ProgramInfo> programs;
+  programs.reserve(size());
+  for (size_t i = 0; i < size(); i++) {
+    programs.push_back(program(i));
+  }
+  return programs;
+}
+
+};
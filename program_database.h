@@ -0,0 +1,119 @@
+// -*- C++ -*-
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+namespace Oceanus {
+
+// What the module reports about one program of its list
+struct ProgramInfo
+{
+  string name;
+  string ensemble;
+  uint8_t program_type = 0;       // PTY code
+  uint8_t frequency_index = 0;
+  uint8_t ecc = 0;                // extended country code
+  uint8_t country = 0;            // country id
+  bool details = false;           // set when the fields after the name are known
+
+  bool operator==(const ProgramInfo& other) const
+  {
+    return name == other.name && ensemble == other.ensemble && program_type == other.program_type
+      && frequency_index == other.frequency_index && ecc == other.ecc && country == other.country
+      && details == other.details;
+  }
+  bool operator!=(const ProgramInfo& other) const { return !(*this == other); }
+};
+
+// The module's program list, persisted in a file that is mapped into
+// memory.  The file is keyed by the identity of the module, the
+// SYSTEM_GetAllVersion response, so a database stored for one module
+// or firmware is never used with another.  Every store() increments
+// the generation stamp.
+//
+// The file consists of a FileHeader, an Entry per program, the
+// identity and the UTF-8 program and ensemble names.  Offsets are from
+// the start of the file.  It is replaced atomically, so readers see
+// either the previous or the new database.
+
+class ProgramDatabase
+{
+public:
+  struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;         // programs
+    uint64_t generation;
+    uint64_t length;        // of the file
+    uint32_t identity_offset;
+    uint32_t identity_length;
+  };
+
+  struct Entry {
+    uint32_t name_offset;
+    uint32_t name_length;
+    uint32_t ensemble_offset;
+    uint32_t ensemble_length;
+    uint8_t program_type;
+    uint8_t frequency_index;
+    uint8_t ecc;
+    uint8_t country;
+    uint8_t flags;
+    uint8_t reserved[3];
+  };
+
+  enum EntryFlags : uint8_t {
+    Details = 0x01
+  };
+
+  static constexpr char magic[8] = { 'T', '4', 'B', 'P', 'R', 'G', 'D', 'B' };
+  static const uint32_t version = 2;
+
+  ProgramDatabase(const string& path);
+  ~ProgramDatabase();
+
+  ProgramDatabase(const ProgramDatabase&) = delete;
+  ProgramDatabase& operator=(const ProgramDatabase&) = delete;
+
+  // Map the file.  Returns false if it does not exist, is damaged or
+  // belongs to a module with a different identity.
+  bool load(const string& identity);
+
+  // Write the programs of the module with the given identity and map
+  // the result
+  void store(const string& identity, const vector<ProgramInfo>& programs);
+
+  // Forget the stored programs, for example after the module's
+  // database has been cleared
+  void invalidate();
+
+  bool valid() const { return _header != nullptr; }
+  uint64_t generation() const { return _generation; }
+  const string& path() const { return _path; }
+
+  // Valid databases only.  The views stay valid until the next load(),
+  // store() or invalidate().
+  size_t size() const { return _header->count; }
+  string_view name(size_t index) const;
+  ProgramInfo program(size_t index) const;
+  vector<ProgramInfo> programs() const;
+
+private:
+  const string _path;
+  uint64_t _generation;
+
+  const FileHeader* _header;
+  size_t _length;
+
+  const Entry& entry(size_t index) const { return reinterpret_cast<const Entry*>(_header + 1)[index]; }
+  string_view text(uint32_t offset, uint32_t length) const { return string_view(reinterpret_cast<const char*>(_header) + offset, length); }
+  void unmap();
+};
+
+};
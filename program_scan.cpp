@@ -0,0 +1,207 @@
+#include <program_scan.h>
+#include <commands.h>
+
+#include <cstdio>
+#include <fstream>
+
+namespace Oceanus {
+
+ProgramScan::ProgramScan(Radio& radio, Reactor& reactor, ProgramCatalogue& catalogue)
+  : _radio(radio),
+    _reactor(reactor),
+    _catalogue(catalogue),
+    _resumable(false),
+    _searching(false),
+    _calls(radio),
+    _poll_timer(0)
+{
+}
+
+ProgramScan::~ProgramScan()
+{
+  cancel_calls();
+}
+
+void
+ProgramScan::set_checkpoint_path(const string& path)
+{
+  _checkpoint_path = path;
+
+  ifstream file(path);
+  unsigned first, last, channel;
+  if (file >> first >> last >> channel && first <= channel && channel <= last && last <= last_channel) {
+    _progress.first = first;
+    _progress.last = last;
+    _progress.channel = channel;
+    _resumable = true;
+  }
+}
+
+void
+ProgramScan::save_checkpoint()
+{
+  if (_checkpoint_path.empty()) {
+    return;
+  }
+  if (!_resumable) {
+    remove(_checkpoint_path.c_str());
+    return;
+  }
+  ofstream file(_checkpoint_path, ios::trunc);
+  file << _progress.first << " " << _progress.last << " " << _progress.channel << endl;
+}
+
+void
+ProgramScan::start(unsigned first, unsigned last)
+{
+  if (first > last || last > last_channel) {
+    throw invalid_argument("Channels to scan must be from 0 to " + to_string(last_channel));
+  }
+  if (_progress.running) {
+    stop();
+  }
+
+  cancel_calls();
+  _progress.first = first;
+  _progress.last = last;
+  _progress.channel = first;
+  // Searching from the first channel starts a new list
+  _progress.programs = first ? _catalogue.size() : 0;
+  _progress.running = true;
+  _progress.finished = false;
+  _resumable = true;
+  _searching = false;
+  _started = Reactor::clock::now();
+  save_checkpoint();
+  report();
+
+  _calls.submit(Commands::Stream::AutoSearch::encode(first, last), [this](response_ptr response, exception_ptr error) {
+    try {
+      if (error) {
+        rethrow_exception(error);
+      }
+      Commands::Stream::AutoSearch::decode(*response);
+    }
+    catch (exception& error) {
+      OCEANUS_LOG(LOG_WARNING, [message = string(error.what())](ostream& os) {
+        os << "Cannot start scan: " << message;
+      });
+      _progress.running = false;
+      report();
+      return;
+    }
+    poll();
+  });
+}
+
+bool
+ProgramScan::resume()
+{
+  if (!resumable()) {
+    return false;
+  }
+  // The channel that was being searched is searched again
+  start(_progress.channel, _progress.last);
+  return true;
+}
+
+void
+ProgramScan::stop()
+{
+  if (!_progress.running) {
+    return;
+  }
+  cancel_calls();
+  _progress.running = false;
+  save_checkpoint();
+
+  _calls.submit(Commands::Stream::StopSearch::encode(), [this](response_ptr, exception_ptr) {
+    // Whatever was found until now becomes part of the list
+    _catalogue.update();
+  });
+  report();
+}
+
+void
+ProgramScan::schedule_poll()
+{
+  _poll_timer = _reactor.add_timer(Reactor::clock::now() + _poll_interval, [this]() {
+    _poll_timer = 0;
+    poll();
+  });
+}
+
+void
+ProgramScan::poll()
+{
+  using namespace Commands::Stream;
+
+  struct Result {
+    uint8_t status = 0;
+    uint8_t channel = 0;
+    uint32_t programs = 0;
+  };
+  auto result = make_shared<Result>();
+
+  // Progress is shown as it is made, so it comes with the metadata
+  _calls.submit_batch({
+      { GetPlayStatus::encode(),
+        [result](const Response& response) { result->status = get<0>(GetPlayStatus::decode(response)); } },
+      { GetSearchProgram::encode(),
+        [result](const Response& response) { result->channel = GetSearchProgram::decode(response); } },
+      { GetTotalProgram::encode(),
+        [result](const Response& response) { result->programs = GetTotalProgram::decode(response); } }
+    }, [this, result](bool succeeded) {
+      // Most likely line noise, the next poll will tell
+      if (!succeeded) {
+        schedule_poll();
+        return;
+      }
+      _progress.programs = result->programs;
+      _catalogue.extend(result->programs);
+      if (result->status == Radio::Searching) {
+        _searching = true;
+      } else if (_searching || Reactor::clock::now() - _started >= _start_time) {
+        finish();
+        return;
+      } else {
+        schedule_poll();
+        return;
+      }
+      if (result->channel != _progress.channel && result->channel <= _progress.last) {
+        _progress.channel = result->channel;
+        save_checkpoint();
+      }
+      report();
+      schedule_poll();
+    }, Radio::METADATA);
+}
+
+void
+ProgramScan::finish()
+{
+  _progress.channel = _progress.last;
+  _progress.running = false;
+  _progress.finished = true;
+  _resumable = false;
+  save_checkpoint();
+  report();
+}
+
+void
+ProgramScan::cancel_calls()
+{
+  _reactor.cancel_timer(_poll_timer);
+  _poll_timer = 0;
+  _calls.cancel();
+}
+
+void
+ProgramScan::report()
+{
+  if (_progress_handler) {
+    _progress_handler(_progress);
+  }
+}
+
+};
@@ -0,0 +1,94 @@
+// -*- C++ -*-
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include <call_group.h>
+#include <oceanus.h>
+#include <program_catalogue.h>
+
+using namespace std;
+
+namespace Oceanus {
+
+// A channel scan that reports its progress while it runs.  start()
+// sends STREAM_AutoSearch and then polls the channel being searched
+// and the number of programs found, passing new programs to the
+// catalogue as they appear, so that they can be listed and tuned to
+// long before the scan has finished.  The channel being searched is
+// kept as a checkpoint, optionally in a file, from which a stopped
+// scan is resumed without losing the programs found so far.
+//
+// A search that ends other than by stop() counts as finished.  The
+// module may take a moment to start searching, so until it reports
+// Searching, other statuses only end the scan after _start_time.
+// Reactor thread only.
+
+class ProgramScan
+{
+public:
+  // The module stops at the end of its frequency table
+  static const unsigned last_channel = 200;
+
+  ProgramScan(Radio& radio, Reactor& reactor, ProgramCatalogue& catalogue);
+  ~ProgramScan();
+
+  ProgramScan(const ProgramScan&) = delete;
+  ProgramScan& operator=(const ProgramScan&) = delete;
+
+  struct Progress {
+    unsigned first = 0;             // channels being searched
+    unsigned last = last_channel;
+    unsigned channel = 0;           // the one being searched now
+    uint32_t programs = 0;          // found so far, on all channels
+    bool running = false;
+    bool finished = false;          // searched up to the last channel
+  };
+
+  using progress_handler = function<void(const Progress& progress)>;
+  void on_progress(progress_handler handler) { _progress_handler = handler; }
+
+  // Keep the checkpoint in a file, and pick up a stopped scan from it
+  void set_checkpoint_path(const string& path);
+
+  void start(unsigned first = 0, unsigned last = last_channel);
+  // Continue a stopped scan.  Returns false if there is none.
+  bool resume();
+  // Abort with STREAM_StopSearch
+  void stop();
+
+  bool running() const { return _progress.running; }
+  bool resumable() const { return _resumable && !_progress.running; }
+  const Progress& progress() const { return _progress; }
+
+private:
+  const chrono::milliseconds _poll_interval{250};
+  const chrono::seconds _start_time{5};
+
+  Radio& _radio;
+  Reactor& _reactor;
+  ProgramCatalogue& _catalogue;
+
+  string _checkpoint_path;
+  Progress _progress;
+  bool _resumable;
+  bool _searching;                  // reported since start()
+  Reactor::time_point _started;
+
+  CallGroup _calls;                 // cancelled by start() and stop()
+  Reactor::timer_id _poll_timer;
+
+  progress_handler _progress_handler;
+
+  void poll();
+  void schedule_poll();
+  void finish();
+  void cancel_calls();
+  void save_checkpoint();
+  void report();
+};
+
+};
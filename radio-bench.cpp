@@ -0,0 +1,783 @@
+#include <oceanus.h>
+#include <program_catalogue.h>
+#include <service_index.h>
+#include <state_export.h>
+#include <commands.h>
+#include <module_simulator.h>
+#include <nullstream.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include <unistd.h>
+
+using namespace std;
+using namespace Oceanus;
+
+// Micro benchmarks of the protocol and transcoding code, and end to
+// end scenarios against a simulated module in the same process.  The
+// simulated module answers without latency or line speed limits, so
+// the end to end figures measure host CPU cost.  Results are written
+// as JSON.
+
+using bench_clock = chrono::steady_clock;
+
+// Heap allocations of the whole process, the simulated module's
+// included.  All replaceable forms of new and delete are replaced, so
+// that every block is allocated and released the same way.  Not
+// inlined, as GCC would otherwise see the free() of a block from new.
+static atomic<uint64_t> allocations;
+
+__attribute__((noinline)) static void*
+allocate(size_t size) noexcept
+{
+  allocations.fetch_add(1, memory_order_relaxed);
+  return malloc(size ? size : 1);
+}
+
+__attribute__((noinline)) static void
+release(void* block) noexcept
+{
+  free(block);
+}
+
+void*
+operator new(size_t size)
+{
+  if (void* block = allocate(size)) {
+    return block;
+  }
+  throw bad_alloc();
+}
+
+void*
+operator new[](size_t size)
+{
+  if (void* block = allocate(size)) {
+    return block;
+  }
+  throw bad_alloc();
+}
+
+void*
+operator new(size_t size, const nothrow_t&) noexcept
+{
+  return allocate(size);
+}
+
+void*
+operator new[](size_t size, const nothrow_t&) noexcept
+{
+  return allocate(size);
+}
+
+void
+operator delete(void* block) noexcept
+{
+  release(block);
+}
+
+void
+operator delete[](void* block) noexcept
+{
+  release(block);
+}
+
+void
+operator delete(void* block, size_t) noexcept
+{
+  release(block);
+}
+
+void
+operator delete[](void* block, size_t) noexcept
+{
+  release(block);
+}
+
+void
+operator delete(void* block, const nothrow_t&) noexcept
+{
+  release(block);
+}
+
+void
+operator delete[](void* block, const nothrow_t&) noexcept
+{
+  release(block);
+}
+
+template <class T>
+static inline void
+keep(const T& value)
+{
+  asm volatile("" : : "g"(&value) : "memory");
+}
+
+class Report
+{
+public:
+  using metrics = vector<pair<string, double>>;
+
+  void add(const string& name, const metrics& values);
+  void write(ostream& os) const;
+
+private:
+  vector<pair<string, metrics>> _results;
+};
+
+void
+Report::add(const string& name, const metrics& values)
+{
+  cerr << name;
+  for (auto& value : values) {
+    cerr << ' ' << value.first << '=' << value.second;
+  }
+  cerr << endl;
+  _results.push_back({ name, values });
+}
+
+void
+Report::write(ostream& os) const
+{
+  os << setprecision(10) << "{\n  \"benchmarks\": [";
+  for (unsigned i = 0; i < _results.size(); i++) {
+    os << (i ? ",\n" : "\n") << "    { \"name\": \"" << _results[i].first << "\"";
+    for (auto& value : _results[i].second) {
+      os << ", \"" << value.first << "\": " << value.second;
+    }
+    os << " }";
+  }
+  os << "\n  ]\n}\n";
+}
+
+class Benchmarks
+{
+public:
+  Benchmarks(Report& report, const string& filter, chrono::milliseconds min_time)
+    : _report(report),
+      _filter(filter),
+      _min_time(min_time)
+  {}
+
+  void run();
+
+private:
+  Report& _report;
+  string _filter;
+  chrono::duration<double> _min_time;
+
+  bool selected(const string& name) const { return name.find(_filter) != string::npos; }
+
+  template <class F>
+  void measure(const string& name, F operation);
+
+  ModuleSimulator::Options simulator_options(unsigned programs) const;
+  unique_ptr<Transport> open_transport(Reactor& reactor, const string& transport, unsigned programs,
+                                       chrono::microseconds latency = chrono::microseconds(0)) const;
+
+  void protocol();
+  void corrupted_length();
+  void service_index();
+  void status_poll(const string& transport);
+  void snapshot_read();
+  void state_export();
+  void get_programs(const string& transport, unsigned pipeline_depth, chrono::milliseconds latency);
+  void tune_latency(const string& transport);
+  void interactive_latency();
+  void catalogue(const string& transport);
+};
+
+// Run the operation in batches of growing size until one batch takes
+// at least the minimum time
+template <class F>
+void
+Benchmarks::measure(const string& name, F operation)
+{
+  if (!selected(name)) {
+    return;
+  }
+
+  uint64_t iterations = 1;
+  chrono::duration<double> elapsed;
+  for (;;) {
+    auto start = bench_clock::now();
+    for (uint64_t i = 0; i < iterations; i++) {
+      operation(i);
+    }
+    elapsed = bench_clock::now() - start;
+    if (elapsed >= _min_time) {
+      break;
+    }
+    double factor = elapsed.count() > 0 ? 1.2 * _min_time / elapsed : 100;
+    iterations = ceil(iterations * min(max(factor, 2.0), 100.0));
+  }
+
+  _report.add(name, { { "iterations", iterations },
+                      { "ns_per_op", elapsed.count() * 1e9 / iterations } });
+}
+
+static vector<uint8_t>
+frame(uint8_t command_type, uint8_t command, const vector<uint8_t>& payload)
+{
+  vector<uint8_t> bytes = { 0xfe, command_type, command, 0,
+                            (uint8_t) (payload.size() >> 8), (uint8_t) (payload.size() & 0xff) };
+  bytes.insert(bytes.end(), payload.begin(), payload.end());
+  bytes.push_back(0xfd);
+  return bytes;
+}
+
+static vector<uint8_t>
+ucs2(const u16string& text)
+{
+  vector<uint8_t> bytes;
+  for (auto c : text) {
+    bytes.push_back(c >> 8);
+    bytes.push_back(c & 0xff);
+  }
+  return bytes;
+}
+
+ModuleSimulator::Options
+Benchmarks::simulator_options(unsigned programs) const
+{
+  ModuleSimulator::Options options;
+  options.programs = programs;
+  options.latency = chrono::microseconds(0);
+  options.baud_rate = 0;
+  options.tune_time = chrono::milliseconds(0);
+  options.dls_interval = chrono::hours(1);
+  options.mot_interval = chrono::hours(1);
+  return options;
+}
+
+unique_ptr<Transport>
+Benchmarks::open_transport(Reactor& reactor, const string& transport, unsigned programs,
+                           chrono::microseconds latency) const
+{
+  auto options = simulator_options(programs);
+  options.latency = latency;
+  if (transport == "pty") {
+    return make_unique<SimulatedPty>(reactor, options);
+  }
+  return make_unique<SimulatedLoopback>(reactor, options);
+}
+
+void
+Benchmarks::protocol()
+{
+  measure("request_construction", [](uint64_t i) {
+    Request request(STREAM, STREAM_GetProgramName, Arguments().u32(i));
+    keep(request);
+  });
+
+  measure("request_construction_typed", [](uint64_t i) {
+    auto command = Commands::Stream::GetProgramName::encode(i);
+    Request request(command.command_type, command.command, command.arguments);
+    keep(request);
+  });
+
+  auto name_frame = frame(STREAM, STREAM_GetProgramName, ucs2(u"Rádio Comércial Lisboa"));
+  auto name_response = Response::create({ name_frame.data(), (unsigned) name_frame.size() });
+
+  measure("packet_validate", [&](uint64_t) {
+    name_response->validate();
+    keep(*name_response);
+  });
+
+  measure("response_create", [&](uint64_t) {
+    auto response = Response::create({ name_frame.data(), (unsigned) name_frame.size() });
+    keep(response);
+  });
+
+  ostringstream os;
+  measure("packet_format", [&](uint64_t) {
+    os.str("");
+    os << *name_response;
+    keep(os);
+  });
+
+  measure("command_name", [](uint64_t i) {
+    static const uint8_t types[] = { SYSTEM, STREAM, RTC, MOT, NOTIFICATION, GPIO };
+    auto name = command_name(types[i % 6], i & 0x3f);
+    keep(name);
+  });
+
+  if (!selected("convert_string")) {
+    return;
+  }
+
+  Reactor reactor;
+  Radio radio(open_transport(reactor, "loopback", 1), reactor);
+
+  auto name = ucs2(u"Rádio Comércial Lisboa");
+  measure("convert_string_name", [&](uint64_t) {
+    auto text = radio.convert_string(name.data(), name.size());
+    keep(text);
+  });
+
+  // As sent by the module, in a fixed size field
+  auto padded = ucs2(u"Jazz Café");
+  padded.resize(32);
+  if (radio.convert_string(padded.data(), padded.size()) != "Jazz Café") {
+    throw logic_error("Padding kept in converted name");
+  }
+  measure("convert_string_padded", [&](uint64_t) {
+    auto text = radio.convert_string(padded.data(), padded.size());
+    keep(text);
+  });
+
+  auto dls = ucs2(u"Now playing: Götterdämmerung - Wagner, Wiener Philharmoniker, "
+                  u"conducted by Sir Georg Solti. Up next: News and weather at 12:00");
+  measure("convert_string_dls", [&](uint64_t) {
+    auto text = radio.convert_string(dls.data(), dls.size());
+    keep(text);
+  });
+}
+
+// Recovery from a response whose length field was damaged on the line.
+// Until the parser gives up on that frame, everything received after
+// it is taken for its payload.
+void
+Benchmarks::corrupted_length()
+{
+  string name = "resync_corrupted_length";
+  if (!selected(name)) {
+    return;
+  }
+
+  // Answers every request with an empty response, with the length's
+  // high byte set to 0x40 when asked to
+  Reactor reactor;
+  auto transport = make_unique<LoopbackTransport>(reactor);
+  auto& module = *transport;
+  bool corrupt = false;
+  module.set_peer([&](const uint8_t* data, size_t) {
+    uint8_t response[] = { 0xfe, data[1], data[2], data[3], 0, 0, 0xfd };
+    if (corrupt) {
+      response[4] = 0x40;
+      corrupt = false;
+    }
+    module.deliver(response, sizeof response);
+  });
+  Radio radio(move(transport), reactor);
+
+  corrupt = true;
+  auto start = bench_clock::now();
+  try {
+    radio.call<Commands::System::GetSysRdy>();
+    throw logic_error("Response with a damaged length accepted");
+  }
+  catch (radio_timeout&) {
+  }
+  radio.call<Commands::System::GetSysRdy>();
+  chrono::duration<double, milli> elapsed = bench_clock::now() - start;
+  if (!radio.get_resyncs()) {
+    throw logic_error("Recovered from a damaged length without resyncing");
+  }
+
+  _report.add(name, { { "iterations", 1 },
+                      { "recovery_ms", elapsed.count() },
+                      { "resyncs", radio.get_resyncs() } });
+}
+
+// Lookups across the lists of several modules with thousands of
+// services between them
+void
+Benchmarks::service_index()
+{
+  if (!selected("service_index")) {
+    return;
+  }
+
+  const unsigned modules = 4;
+  const unsigned programs = 1000;
+  static const char* words[] = { "Radio", "Antenne", "Bayern", "Klassik", "Jazz", "News", "Sport", "Pop",
+                                 "Rock", "Kultur", "Welle", "Info", "Melodie", "Heimat", "Schlager", "Club" };
+
+  ServiceIndex index;
+  auto start = bench_clock::now();
+  for (unsigned module = 0; module < modules; module++) {
+    for (unsigned i = 0; i < programs; i++) {
+      ProgramInfo program;
+      program.name = string(words[i % 16]) + " " + words[i / 16 % 16] + " " + to_string(i);
+      program.ensemble = "Multiplex " + to_string(i / 8);
+      program.program_type = i % 32;
+      program.frequency_index = i / 8 % 41;
+      program.ecc = 0xe0;
+      program.details = true;
+      index.set(module, i, program);
+    }
+  }
+  chrono::duration<double> elapsed = bench_clock::now() - start;
+  _report.add("service_index_build_4000", { { "iterations", 1 },
+                                            { "ns_per_op", elapsed.count() * 1e9 / (modules * programs) } });
+
+  measure("service_index_prefix_unique", [&](uint64_t) {
+    auto found = index.find_prefix("klassik jazz 5");
+    keep(found);
+  });
+
+  measure("service_index_prefix_word", [&](uint64_t) {
+    auto found = index.find_prefix("schla");
+    keep(found);
+  });
+
+  ServiceIndex::Filter filter;
+  filter.ensemble = "multiplex 42";
+  filter.program_type = 16;
+  measure("service_index_filter", [&](uint64_t) {
+    auto found = index.find(filter);
+    keep(found);
+  });
+}
+
+void
+Benchmarks::status_poll(const string& transport)
+{
+  string name = "status_poll_" + transport;
+  if (!selected(name)) {
+    return;
+  }
+
+  Reactor reactor;
+  Radio radio(open_transport(reactor, transport, 40), reactor);
+  radio.play_dab(1);
+  radio.handle_status();
+
+  uint64_t polls = 0;
+  uint64_t allocated = allocations;
+  auto start = bench_clock::now();
+  chrono::duration<double> elapsed;
+  do {
+    radio.handle_status();
+    polls++;
+    elapsed = bench_clock::now() - start;
+  } while (elapsed < _min_time);
+  allocated = allocations - allocated;
+
+  _report.add(name, { { "iterations", polls },
+                      { "polls_per_second", polls / elapsed.count() },
+                      { "us_per_poll", elapsed.count() * 1e6 / polls },
+                      { "allocations_per_poll", (double) allocated / polls } });
+}
+
+// Snapshots taken by another thread while the reactor thread tunes
+// and polls the status as fast as it can
+void
+Benchmarks::snapshot_read()
+{
+  string name = "snapshot_read";
+  if (!selected(name)) {
+    return;
+  }
+
+  Reactor reactor;
+  Radio radio(open_transport(reactor, "loopback", 40), reactor);
+
+  atomic<bool> done(false);
+  uint64_t reads = 0;
+  bool ordered = true;
+  thread reader([&]() {
+    uint64_t version = 0;
+    while (!done.load(memory_order_relaxed)) {
+      auto snapshot = radio.snapshot();
+      ordered &= snapshot.version >= version;
+      version = snapshot.version;
+      reads++;
+    }
+  });
+
+  uint64_t polls = 0;
+  auto start = bench_clock::now();
+  chrono::duration<double> elapsed;
+  do {
+    radio.play_dab(polls % 40);
+    do {
+      radio.handle_status();
+      polls++;
+    } while (radio.get_play_status() != Radio::Playing);
+    elapsed = bench_clock::now() - start;
+  } while (elapsed < _min_time);
+  done = true;
+  reader.join();
+
+  if (!ordered) {
+    throw logic_error("Snapshot versions went backwards");
+  }
+  _report.add(name, { { "iterations", reads },
+                      { "reads_per_second", reads / elapsed.count() },
+                      { "ns_per_read", elapsed.count() * 1e9 / reads },
+                      { "states_published", radio.snapshot_stores() },
+                      { "polls_per_second", polls / elapsed.count() } });
+}
+
+// From StateExport::publish() until a thread waiting on the futex has
+// read the new snapshot, and the cost of publishing
+void
+Benchmarks::state_export()
+{
+  string name = "state_export_wake";
+  if (!selected(name)) {
+    return;
+  }
+
+  string path = "/dev/shm/radio-bench." + to_string(getpid()) + ".state";
+  auto writer = make_unique<StateExport>(path);
+  StateReader reader(path);
+  unlink(path.c_str());
+
+  Radio::Snapshot snapshot = {};
+  atomic<uint64_t> published(0);
+  atomic<uint64_t> seen(0);
+  vector<double> samples;
+  thread waiter([&]() {
+    uint32_t changes = reader.changes();
+    while (!reader.closed()) {
+      reader.wait(changes, chrono::milliseconds(100));
+      changes = reader.changes();
+      seen = reader.snapshot().version;
+    }
+  });
+
+  auto end = bench_clock::now() + _min_time;
+  while (bench_clock::now() < end || samples.size() < 10) {
+    snapshot.version = ++published;
+    auto start = bench_clock::now();
+    writer->publish(snapshot);
+    while (seen.load() != snapshot.version) {
+    }
+    samples.push_back(chrono::duration<double, micro>(bench_clock::now() - start).count());
+  }
+  // Closing wakes the waiter for good
+  writer.reset();
+  waiter.join();
+
+  sort(samples.begin(), samples.end());
+  _report.add(name, { { "iterations", samples.size() },
+                      { "p50_us", samples[samples.size() / 2] },
+                      { "p99_us", samples[samples.size() * 99 / 100] } });
+}
+
+// Without latency, the module answers as soon as a request arrives and
+// pipelining has nothing to hide: a deeper pipeline only adds
+// bookkeeping, as more calls are in flight and more of the simulated
+// module's response timers are pending at a time, so the host CPU cost
+// is measured.  With latency, responses to the calls in flight overlap
+// in the simulated module, as they do in a module working on several
+// requests, and the saving from pipelining shows.  The reactor's
+// timers have millisecond resolution, so latencies are whole
+// milliseconds.
+void
+Benchmarks::get_programs(const string& transport, unsigned pipeline_depth, chrono::milliseconds latency)
+{
+  const unsigned programs = 500;
+
+  string name = "get_programs_" + to_string(programs) + "_depth" + to_string(pipeline_depth)
+    + (latency.count() ? "_latency" + to_string(latency.count()) + "ms" : "") + "_" + transport;
+  if (!selected(name)) {
+    return;
+  }
+
+  Reactor reactor;
+  Radio radio(open_transport(reactor, transport, programs, latency), reactor);
+  radio.set_pipeline_depth(pipeline_depth);
+
+  uint64_t runs = 0;
+  auto start = bench_clock::now();
+  chrono::duration<double> elapsed;
+  do {
+    radio.get_programs();
+    runs++;
+    elapsed = bench_clock::now() - start;
+  } while (elapsed < _min_time);
+
+  if (radio._programs.size() != programs) {
+    throw logic_error("get_programs returned " + to_string(radio._programs.size()) + " programs");
+  }
+
+  _report.add(name, { { "iterations", runs },
+                      { "ms_per_run", elapsed.count() * 1e3 / runs },
+                      { "programs_per_second", runs * programs / elapsed.count() } });
+}
+
+// A command typed while a program list is being fetched, with a
+// module that takes 100 µs per response
+void
+Benchmarks::interactive_latency()
+{
+  string name = "interactive_under_load";
+  if (!selected(name)) {
+    return;
+  }
+
+  auto options = simulator_options(500);
+  options.latency = chrono::microseconds(100);
+  Reactor reactor;
+  Radio radio(make_unique<SimulatedLoopback>(reactor, options), reactor);
+
+  vector<double> samples;
+  auto end = bench_clock::now() + _min_time;
+  while (bench_clock::now() < end || samples.size() < 10) {
+    auto programs = radio.async_get_programs();
+    while (!programs.ready()) {
+      auto start = bench_clock::now();
+      radio.set_volume(samples.size() % 16);
+      samples.push_back(chrono::duration<double, micro>(bench_clock::now() - start).count());
+    }
+    programs.get();
+  }
+
+  sort(samples.begin(), samples.end());
+  _report.add(name, { { "iterations", samples.size() },
+                      { "p50_us", samples[samples.size() / 2] },
+                      { "p99_us", samples[samples.size() * 99 / 100] },
+                      { "max_us", samples.back() } });
+}
+
+// Time from play_dab() until status polling has seen the module
+// playing and fetched the new program's details
+void
+Benchmarks::tune_latency(const string& transport)
+{
+  string name = "tune_latency_" + transport;
+  if (!selected(name)) {
+    return;
+  }
+
+  Reactor reactor;
+  Radio radio(open_transport(reactor, transport, 40), reactor);
+
+  vector<double> samples;
+  auto end = bench_clock::now() + _min_time;
+  for (unsigned i = 0; bench_clock::now() < end || samples.size() < 10; i++) {
+    auto start = bench_clock::now();
+    radio.play_dab(i % 40);
+    do {
+      radio.handle_status();
+    } while (radio.get_play_status() != Radio::Playing);
+    samples.push_back(chrono::duration<double, micro>(bench_clock::now() - start).count());
+  }
+
+  sort(samples.begin(), samples.end());
+  double sum = 0;
+  for (auto sample : samples) {
+    sum += sample;
+  }
+  _report.add(name, { { "iterations", samples.size() },
+                      { "mean_us", sum / samples.size() },
+                      { "p50_us", samples[samples.size() / 2] },
+                      { "p99_us", samples[samples.size() * 99 / 100] },
+                      { "max_us", samples.back() } });
+}
+
+// Time from ProgramCatalogue::refresh() until the list is usable, the
+// focused name has arrived and all names are known
+void
+Benchmarks::catalogue(const string& transport)
+{
+  const unsigned programs = 500;
+  const unsigned focus = 250;
+
+  string name = "catalogue_" + to_string(programs) + "_" + transport;
+  if (!selected(name)) {
+    return;
+  }
+
+  Reactor reactor;
+  Radio radio(open_transport(reactor, transport, programs), reactor);
+  ProgramCatalogue catalogue(radio, reactor);
+
+  double loaded = 0, focused = 0, complete = 0;
+  uint64_t runs = 0;
+  auto end = bench_clock::now() + _min_time;
+  do {
+    auto start = bench_clock::now();
+    catalogue.refresh();
+    catalogue.focus(focus);
+    reactor.run_until([&] { return catalogue.loaded(); });
+    loaded += chrono::duration<double, micro>(bench_clock::now() - start).count();
+    reactor.run_until([&] { return catalogue.resolved(focus); });
+    focused += chrono::duration<double, micro>(bench_clock::now() - start).count();
+    reactor.run_until([&] { return catalogue.complete(); });
+    complete += chrono::duration<double, micro>(bench_clock::now() - start).count();
+    runs++;
+  } while (bench_clock::now() < end);
+
+  _report.add(name, { { "iterations", runs },
+                      { "loaded_us", loaded / runs },
+                      { "focused_us", focused / runs },
+                      { "complete_us", complete / runs } });
+}
+
+void
+Benchmarks::run()
+{
+  protocol();
+  corrupted_length();
+  service_index();
+  snapshot_read();
+  state_export();
+
+  for (string transport : { "loopback", "pty" }) {
+    status_poll(transport);
+    for (auto latency : { chrono::milliseconds(0), chrono::milliseconds(1) }) {
+      get_programs(transport, 1, latency);
+      get_programs(transport, 16, latency);
+    }
+    tune_latency(transport);
+    catalogue(transport);
+  }
+  interactive_latency();
+}
+
+static void
+usage()
+{
+  cerr << "usage: radio-bench [--output FILE] [--time MS] [FILTER]" << endl
+       << "  runs the benchmarks whose name contains FILTER and writes the results as JSON" << endl;
+  exit(1);
+}
+
+int
+main(int argc, char* argv[])
+{
+  string output;
+  string filter;
+  chrono::milliseconds min_time(200);
+
+  for (int i = 1; i < argc; i++) {
+    string option = argv[i];
+    if (option == "--output" && i + 1 < argc) {
+      output = argv[++i];
+    } else if (option == "--time" && i + 1 < argc) {
+      min_time = chrono::milliseconds(stoul(argv[++i]));
+    } else if (option[0] == '-') {
+      usage();
+    } else {
+      filter = option;
+    }
+  }
+
+  // Radio reports status changes on cout
+  nullstream null;
+  auto cout_buffer = cout.rdbuf(null.rdbuf());
+
+  Report report;
+  Benchmarks(report, filter, min_time).run();
+
+  cout.rdbuf(cout_buffer);
+  if (output.length()) {
+    ofstream file(output);
+    report.write(file);
+  } else {
+    report.write(cout);
+  }
+}
@@ -1,10 +1,25 @@
 
 #include <oceanus.h>
+#include <commands.h>
+#include <program_catalogue.h>
+#include <program_scan.h>
+#include <module_simulator.h>
+#include <session.h>
+#include <control_server.h>
+#include <magic_enum.hpp>
 #include <iostream>
 #include <iomanip>
+#include <sstream>
 #include <regex>
 #include <map>
+#include <deque>
+#include <algorithm>
+#include <system_error>
 
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+
+#include <signal.h>
 #include <unistd.h>
 
 using namespace std;
@@ -28,18 +43,97 @@ split(const string& s, string re_str = "\\s+") {
   return elems;
 }
 
+// "sim" and "sim-pty" connect to a simulated module in this process,
+// anything else is taken to be the serial device of a real module
+static unique_ptr<Oceanus::Transport>
+open_device(const string& device_name, Oceanus::Reactor& reactor)
+{
+  if (device_name == "sim") {
+    return make_unique<Oceanus::SimulatedLoopback>(reactor, Oceanus::ModuleSimulator::Options());
+  }
+  if (device_name == "sim-pty") {
+    return make_unique<Oceanus::SimulatedPty>(reactor, Oceanus::ModuleSimulator::Options());
+  }
+  return make_unique<Oceanus::SerialTransport>(reactor, device_name);
+}
+
+static unique_ptr<Oceanus::Transport>
+open_transport(const string& device_name, const string& record_path, Oceanus::Reactor& reactor)
+{
+  auto transport = open_device(device_name, reactor);
+  if (record_path.length()) {
+    transport = make_unique<Oceanus::RecordingTransport>(reactor, move(transport), record_path);
+  }
+  return transport;
+}
+
 class RadioCLI {
 public:
-  RadioCLI(const char* device_name);
+  // With a listen path, commands come from clients of a ControlServer
+  // there instead of stdin, and events are published to them
+  RadioCLI(const string& device_name, const string& record_path, const string& listen_path = "");
 
   void run();
 
 private:
+  const chrono::milliseconds _status_interval{100};
+  // With notifications enabled, status is only polled this often while the radio is playing
+  const chrono::milliseconds _idle_status_interval{10000};
+  const uint16_t _notification_mask =
+    Oceanus::NOTIFY_ScanFinished | Oceanus::NOTIFY_NewProgramText | Oceanus::NOTIFY_Reconfiguration
+    | Oceanus::NOTIFY_SortChanged | Oceanus::NOTIFY_NewFMProgramText;
+
+  // Flight recorder dumps on demand, on errors and on SIGUSR1
+  const string _trace_path = "radio-cli.trace";
+
+  // Programs are only fetched from the module when this is out of date
+  const string _program_database_path = "radio-cli.programs";
+  // In memory, not written back to an SD card
+  const string _state_export_path = "/dev/shm/radio-cli.state";
+  // Where a stopped scan continues
+  const string _scan_checkpoint_path = "radio-cli.scan";
+  // Commands a client may have waiting, more are refused
+  const size_t _max_pending_commands = 16;
+
+  Oceanus::Reactor _reactor;
   Oceanus::Radio _radio;
-
-  bool input_available();
-
-  void handle_command(string command);
+  Oceanus::ServiceIndex _services;
+  Oceanus::ProgramCatalogue _catalogue;
+  Oceanus::ProgramScan _scan;
+
+  bool _quit;
+  bool _status_due;
+  bool _notifications;
+  Oceanus::Reactor::timer_id _status_timer;
+  unique_ptr<Oceanus::ControlServer> _server;
+
+  // From the client, 0 for stdin.  Commands the client sent after this
+  // one while it had too many waiting are answered with an error after
+  // it, so that replies stay in order.
+  struct PendingCommand {
+    Oceanus::ControlServer::client_id client;
+    string command;
+    unsigned refused;
+  };
+  deque<PendingCommand> _pending_commands;
+  map<Oceanus::ControlServer::client_id, size_t> _client_pending;
+  size_t _scan_first_program;
+
+  void loop();
+  void read_input();
+  void handle_notification(uint16_t events);
+  void handle_state_change(const Oceanus::Radio::State& state, uint16_t changed);
+  void handle_catalogue_change(size_t index);
+  void handle_scan_progress(const Oceanus::ProgramScan::Progress& progress);
+  void stop_scan();
+  void schedule_status();
+
+  void queue_command(Oceanus::ControlServer::client_id client, const string& command);
+  void handle_command(Oceanus::ControlServer::client_id client, string command);
+  void execute(string command);
+  // Printed, or published to the clients subscribed to topic.  Of
+  // events with a key, slow clients only get the latest.
+  void event(const string& topic, const string& text, const string& key = "");
 
   using command_handler = void (RadioCLI::*)(vector<string> arguments);
 
@@ -50,41 +144,234 @@ private:
   void fm(vector<string>);
   void volume(vector<string>);
   void scan(vector<string>);
+  void programs(vector<string>);
+  void find(vector<string>);
+
+  void show_program(ostream& os, size_t index, const Oceanus::ProgramInfo& program);
+  void pipeline(vector<string>);
+  void notify(vector<string>);
+  void stats(vector<string>);
+  void dump(vector<string>);
+  void log(vector<string>);
 };
 
-RadioCLI::RadioCLI(const char* device_name)
-  : _radio(device_name)
+RadioCLI::RadioCLI(const string& device_name, const string& record_path, const string& listen_path)
+  : _radio(open_transport(device_name, record_path, _reactor), _reactor),
+    _catalogue(_radio, _reactor),
+    _scan(_radio, _reactor, _catalogue),
+    _quit(false),
+    _status_due(false),
+    _notifications(false),
+    _status_timer(0),
+    _scan_first_program(0)
 {
   _command_handlers["dab"] = &RadioCLI::dab;
   _command_handlers["fm"] = &RadioCLI::fm;
   _command_handlers["volume"] = &RadioCLI::volume;
   _command_handlers["scan"] = &RadioCLI::scan;
+  _command_handlers["programs"] = &RadioCLI::programs;
+  _command_handlers["find"] = &RadioCLI::find;
+  _command_handlers["pipeline"] = &RadioCLI::pipeline;
+  _command_handlers["notify"] = &RadioCLI::notify;
+  _command_handlers["stats"] = &RadioCLI::stats;
+  _command_handlers["dump"] = &RadioCLI::dump;
+  _command_handlers["log"] = &RadioCLI::log;
+
+  _radio.flight_recorder().dump_on_signal(_trace_path, { SIGUSR1, SIGSEGV, SIGBUS, SIGFPE, SIGABRT });
+
+  _radio.on_notification([this](uint16_t events) { handle_notification(events); });
+  _radio.on_state_change([this](const Oceanus::Radio::State& state, uint16_t changed) {
+    handle_state_change(state, changed);
+  });
+  _catalogue.on_change([this](size_t index) { handle_catalogue_change(index); });
+  _catalogue.set_index(&_services);
+  _scan.on_progress([this](const Oceanus::ProgramScan::Progress& progress) { handle_scan_progress(progress); });
+  _scan.set_checkpoint_path(_scan_checkpoint_path);
+
+  if (listen_path.length()) {
+    _server = make_unique<Oceanus::ControlServer>(_reactor, listen_path);
+    // Like read_input(), this may be invoked while waiting for a response
+    _server->on_command([this](Oceanus::ControlServer::client_id client, const string& command) {
+      queue_command(client, command);
+    });
+  }
 
   _radio.set_volume(10);
   _radio.set_stereo_mode(Oceanus::Radio::AUTO_DETECT_STEREO);
 
-  _radio.play_dab(42);
+  const unsigned initial_program = 42;
+  try {
+    _radio.play_dab(initial_program);
+  }
+  catch (Oceanus::command_error& error) {
+    // Fewer programs known to the module, one can be chosen later
+    cout << error.what() << endl;
+  }
+
+  // Names are fetched in the background, starting around the program
+  // being played
+  _radio.set_program_database(_program_database_path);
+  _radio.export_state(_state_export_path);
+  _catalogue.refresh();
+  _catalogue.focus(initial_program);
+}
 
-  _radio.get_programs();
+void
+RadioCLI::read_input()
+{
+  // Commands are only queued here, as this handler may be invoked
+  // while the radio is waiting for a response.
+  do {
+    string command;
+    getline(cin, command);
+    if (cin.eof() || (command == "quit")) {
+      _quit = true;
+      _reactor.remove(0);
+      return;
+    }
+    queue_command(0, command);
+  } while (cin.rdbuf()->in_avail() > 0);
 }
 
-bool
-RadioCLI::input_available()
+void
+RadioCLI::handle_notification(uint16_t events)
 {
-  struct timeval tv;
-  fd_set fds;
+  // Like read_input(), this may be invoked while waiting for a response
+  _status_due = true;
+  // The catalogue only queues its requests
+  if (events & Oceanus::NOTIFY_SortChanged) {
+    _catalogue.refresh();
+  } else if (events & Oceanus::NOTIFY_ScanFinished) {
+    _catalogue.update();
+  }
+}
 
-  tv.tv_sec = tv.tv_usec = 0;
+void
+RadioCLI::handle_state_change(const Oceanus::Radio::State& state, uint16_t changed)
+{
+  // Only what has changed is shown
+  if (changed & Oceanus::STATE_PlayStatus) {
+    event("state", "Play Status: " + string(magic_enum::enum_name(state.play_status)), "play_status");
+  }
+  if ((changed & Oceanus::STATE_ProgramName) && state.program_name.length()) {
+    event("state", "Program Name: " + state.program_name, "program_name");
+  }
+  if ((changed & Oceanus::STATE_ServiceName) && state.service_name.length()) {
+    event("state", "Service Name: " + state.service_name, "service_name");
+  }
+  if ((changed & Oceanus::STATE_ProgramText) && state.program_text.length()) {
+    event("state", "Program Text: " + state.program_text, "program_text");
+  }
+  // Changes every second or so, not worth a line on the terminal
+  if (_server && (changed & Oceanus::STATE_SignalQuality)) {
+    event("state", "Signal Quality: " + to_string(state.signal_quality), "signal_quality");
+  }
+}
 
-  FD_ZERO(&fds);
-  FD_SET(0, &fds);
-  return ::select(1, &fds, 0, 0, &tv) == 1;
+void
+RadioCLI::handle_catalogue_change(size_t index)
+{
+  if (_scan.running()) {
+    // New programs are shown as soon as their details are known
+    if (index != Oceanus::ProgramCatalogue::npos && index >= _scan_first_program && _catalogue.peek(index).details) {
+      ostringstream text;
+      show_program(text, index, _catalogue.peek(index));
+      event("scan", "Found: " + text.str());
+    }
+  } else if (index == Oceanus::ProgramCatalogue::npos && _catalogue.loaded()) {
+    event("programs", "Programs: " + to_string(_catalogue.size()) + (_catalogue.complete() ? "" : ", fetching details"),
+          "count");
+  } else if (index != Oceanus::ProgramCatalogue::npos && _catalogue.complete()) {
+    event("programs", "All program details known", "complete");
+  }
 }
 
 void
-RadioCLI::handle_command(string command)
+RadioCLI::handle_scan_progress(const Oceanus::ProgramScan::Progress& progress)
+{
+  ostringstream text;
+  if (progress.running) {
+    text << "Scan: channel " << progress.channel << " of " << progress.first << "-" << progress.last << ", "
+         << progress.programs << " programs";
+  } else if (progress.finished) {
+    text << "Scan finished, " << progress.programs << " programs";
+  } else {
+    text << "Scan stopped at channel " << progress.channel << ", " << progress.programs
+         << " programs, continue with 'scan resume'";
+  }
+  event("scan", text.str(), "progress");
+}
+
+void
+RadioCLI::stop_scan()
+{
+  // Tuning ends the search, it can be resumed later
+  if (_scan.running()) {
+    _scan.stop();
+  }
+}
+
+void
+RadioCLI::schedule_status()
+{
+  // Without notifications, the status must be polled.  With them, it
+  // only needs polling while the radio is searching or tuning.
+  auto status = _radio.get_play_status();
+  bool settled = _notifications && (status == Oceanus::Radio::Playing || status == Oceanus::Radio::Stop);
+
+  _reactor.cancel_timer(_status_timer);
+  _status_timer = _reactor.add_timer(settled ? _idle_status_interval : _status_interval,
+                                     [this]() { _status_due = true; });
+}
+
+void
+RadioCLI::queue_command(Oceanus::ControlServer::client_id client, const string& command)
+{
+  // Lines from stdin are all run, however many are piped in
+  if (client && _client_pending[client] >= _max_pending_commands) {
+    auto last = find_if(_pending_commands.rbegin(), _pending_commands.rend(),
+                        [client](const PendingCommand& pending) { return pending.client == client; });
+    last->refused++;
+    return;
+  }
+  _pending_commands.push_back({ client, command, 0 });
+  if (client) {
+    _client_pending[client]++;
+  }
+}
+
+void
+RadioCLI::handle_command(Oceanus::ControlServer::client_id client, string command)
+{
+  if (!client) {
+    cout << "Command: " << command << endl;
+    try {
+      execute(command);
+    }
+    catch (exception& failure) {
+      cout << "Error: " << failure.what() << endl;
+    }
+    return;
+  }
+
+  // The output goes to the client that sent the command.  Everything
+  // else that happens meanwhile is published as events, not printed.
+  ostringstream output;
+  auto cout_buffer = cout.rdbuf(output.rdbuf());
+  string error;
+  try {
+    execute(command);
+  }
+  catch (exception& failure) {
+    error = failure.what();
+  }
+  cout.rdbuf(cout_buffer);
+  _server->reply(client, output.str(), error);
+}
+
+void
+RadioCLI::execute(string command)
 {
-  cout << "Command: " << command << endl;
   auto args = split(command);
   if (args.size()) {
     auto command = args[0];
@@ -92,18 +379,52 @@ RadioCLI::handle_command(string command)
     if (_command_handlers.count(command)) {
       auto handler = _command_handlers[command];
       (this->*handler)(args);
+    } else if (_server) {
+      throw invalid_argument("Unknown command: " + command);
     } else {
       cout << "Unknown command: " << command << endl;
     }
   }
 }
 
+void
+RadioCLI::event(const string& topic, const string& text, const string& key)
+{
+  if (_server) {
+    _server->publish(topic, text, key);
+  } else {
+    cout << text << endl;
+  }
+}
+
 void
 RadioCLI::dab(vector<string> args)
 {
-  unsigned channel = stoul(args.at(0));
+  // A program index, or the start of a program's name or of a word in it
+  string program = args.at(0);
+  unsigned channel;
+  if (all_of(program.begin(), program.end(), ::isdigit)) {
+    channel = stoul(program);
+  } else {
+    for (size_t i = 1; i < args.size(); i++) {
+      program += " " + args[i];
+    }
+    auto found = _services.find_prefix(program);
+    if (found.empty()) {
+      cout << "No program matches " << program << (_catalogue.complete() ? "" : " (still fetching names)") << endl;
+      return;
+    }
+    channel = found[0]->index;
+    cout << "Playing " << found[0]->info.name;
+    if (found.size() > 1) {
+      cout << ", " << found.size() - 1 << " more matching";
+    }
+    cout << endl;
+  }
 
+  stop_scan();
   _radio.play_dab(channel);
+  _catalogue.focus(channel);
 }
 
 void
@@ -111,6 +432,7 @@ RadioCLI::fm(vector<string> args)
 {
   unsigned frequency = stof(args.at(0));
 
+  stop_scan();
   _radio.play_fm(frequency);
 }
 
@@ -123,28 +445,216 @@ RadioCLI::volume(vector<string> args)
 }
 
 void
-RadioCLI::scan(vector<string>)
+RadioCLI::scan(vector<string> args)
+{
+  string mode = args.size() ? args.at(0) : "";
+  if (mode == "stop") {
+    _scan.stop();
+    return;
+  }
+  if (mode == "resume") {
+    _scan_first_program = _catalogue.size();
+    if (!_scan.resume()) {
+      cout << "No scan to resume" << endl;
+    }
+    return;
+  }
+  if (mode == "clear") {
+    stop_scan();
+    _radio.reset(Oceanus::Radio::CLEAR_DATABASE);
+    _catalogue.refresh();
+  } else if (mode.size()) {
+    throw invalid_argument("Expecting stop, resume or clear");
+  }
+  _scan_first_program = 0;
+  _scan.start();
+}
+
+void
+RadioCLI::programs(vector<string> args)
+{
+  if (!_catalogue.loaded()) {
+    cout << "Program list not loaded yet" << endl;
+    return;
+  }
+  size_t first = args.size() > 0 ? stoul(args.at(0)) : 0;
+  size_t count = args.size() > 1 ? stoul(args.at(1)) : 20;
+  size_t end = min(_catalogue.size(), first + count);
+  // Anything displayed is fetched first
+  if (first < end) {
+    _catalogue.focus(first + (end - first) / 2, (end - first) / 2);
+  }
+  for (size_t i = first; i < end; i++) {
+    show_program(cout, i, _catalogue.program(i));
+    cout << endl;
+  }
+}
+
+void
+RadioCLI::find(vector<string> args)
 {
-  _radio.reset(Oceanus::Radio::CLEAR_DATABASE);
-  _radio.auto_search(0, 200);
-  _radio.get_programs();
+  // find [PREFIX] [pty=N] [frequency=N] [ecc=N] [ensemble=NAME], the
+  // ensemble name takes the rest of the line
+  Oceanus::ServiceIndex::Filter filter;
+  string prefix;
+  for (size_t i = 0; i < args.size(); i++) {
+    auto equals = args[i].find('=');
+    string key = args[i].substr(0, equals);
+    string value = equals == string::npos ? string() : args[i].substr(equals + 1);
+    if (equals == string::npos) {
+      prefix += (prefix.empty() ? "" : " ") + args[i];
+    } else if (key == "pty") {
+      filter.program_type = stoul(value);
+    } else if (key == "frequency") {
+      filter.frequency_index = stoul(value);
+    } else if (key == "ecc") {
+      filter.ecc = stoul(value, nullptr, 16);
+    } else if (key == "ensemble") {
+      while (++i < args.size()) {
+        value += " " + args[i];
+      }
+      filter.ensemble = value;
+    } else {
+      throw invalid_argument("Expecting pty=, frequency=, ecc= or ensemble=");
+    }
+  }
+  auto found = _services.find_prefix(prefix, filter);
+  for (auto service : found) {
+    show_program(cout, service->index, service->info);
+    cout << endl;
+  }
+  cout << found.size() << " programs found" << (_catalogue.complete() ? "" : " so far") << endl;
+}
+
+void
+RadioCLI::show_program(ostream& os, size_t index, const Oceanus::ProgramInfo& program)
+{
+  os << setw(4) << index << " " << (program.name.empty() ? "..." : program.name);
+  if (program.details) {
+    ios_base::fmtflags f(os.flags());
+    os << " (" << program.ensemble << ", PTY " << (unsigned) program.program_type
+       << ", frequency " << (unsigned) program.frequency_index
+       << ", ECC " << hex << (unsigned) program.ecc << ")";
+    os.flags(f);
+  }
+}
+
+void
+RadioCLI::pipeline(vector<string> args)
+{
+  if (args.size()) {
+    _radio.set_pipeline_depth(stoul(args.at(0)));
+  }
+  cout << "Pipeline depth: " << _radio.get_pipeline_depth() << endl;
+}
+
+void
+RadioCLI::notify(vector<string> args)
+{
+  if (args.size()) {
+    if (args.at(0) == "on") {
+      _notifications = true;
+    } else if (args.at(0) == "off") {
+      _notifications = false;
+    } else {
+      throw invalid_argument("Expecting 'on' or 'off'");
+    }
+    _radio.set_notification(_notifications ? _notification_mask : 0);
+  }
+  cout << "Notifications: " << (_notifications ? "on" : "off") << endl;
+}
+
+void
+RadioCLI::stats(vector<string>)
+{
+  _radio.stats().dump(cout);
+}
+
+void
+RadioCLI::dump(vector<string> args)
+{
+  string path = args.size() ? args.at(0) : _trace_path;
+  if (!_radio.flight_recorder().dump(path.c_str())) {
+    throw runtime_error("Cannot write " + path);
+  }
+  cout << "Flight recorder written to " << path << endl;
+}
+
+void
+RadioCLI::log(vector<string> args)
+{
+  auto& logger = Oceanus::logger();
+  if (args.size()) {
+    string name = args.at(0);
+    transform(name.begin(), name.end(), name.begin(), ::toupper);
+    auto level = magic_enum::enum_cast<Oceanus::LogLevel>("LOG_" + name);
+    if (!level) {
+      throw invalid_argument("Expecting one of error, warning, info, debug or trace");
+    }
+    logger.set_level(*level);
+  }
+  cout << "Log level: " << Oceanus::Logger::level_name(logger.level()) << endl;
 }
 
 void
 RadioCLI::run()
 {
-  while (true) {
-    _radio.handle_status();
-    _radio.handle_mot();
+  try {
+    loop();
+  }
+  catch (...) {
+    _radio.flight_recorder().dump(_trace_path.c_str());
+    cerr << "Flight recorder written to " << _trace_path << endl;
+    throw;
+  }
+}
 
-    usleep(100000);
-    if (input_available()) {
-      string command;
-      getline(cin, command);
-      if (cin.eof() || (command == "quit")) {
-        break;
+void
+RadioCLI::loop()
+{
+  if (!_server) {
+    _reactor.add(0, EPOLLIN, [this](uint32_t) { read_input(); });
+  } else {
+    // Serving clients until told to stop, then the socket is removed
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &signals, nullptr);
+    int fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0) {
+      throw system_error(errno, generic_category(), "Cannot create signalfd");
+    }
+    _reactor.add(fd, EPOLLIN, [this, fd](uint32_t) {
+      _quit = true;
+      _reactor.remove(fd);
+      close(fd);
+    });
+  }
+  _status_due = true;
+
+  while (!_quit) {
+    if (_status_due) {
+      _status_due = false;
+      _radio.handle_status();
+      _radio.handle_mot();
+      schedule_status();
+    }
+    while (!_quit && !_pending_commands.empty()) {
+      auto pending = _pending_commands.front();
+      _pending_commands.pop_front();
+      if (pending.client && !--_client_pending[pending.client]) {
+        _client_pending.erase(pending.client);
+      }
+      handle_command(pending.client, pending.command);
+      for (unsigned i = 0; i < pending.refused; i++) {
+        _server->reply(pending.client, "", "Too many commands waiting");
       }
-      handle_command(command);
+      // Commands usually change the radio state
+      _status_due = true;
+    }
+    if (!_quit && !_status_due) {
+      _reactor.run_once();
     }
   }
 }
@@ -152,11 +662,25 @@ RadioCLI::run()
 int
 main(int argc, char* argv[])
 {
-  if (argc != 2) {
-    throw invalid_argument("Missing command line argument, expecting serial device name");
+  string record_path;
+  string listen_path;
+  int i = 1;
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    string option = argv[i];
+    if (option == "--record") {
+      record_path = argv[i + 1];
+    } else if (option == "--listen") {
+      listen_path = argv[i + 1];
+    } else {
+      break;
+    }
+  }
+  if (i != argc - 1) {
+    throw invalid_argument("usage: radio-cli [--record FILE] [--listen SOCKET] DEVICE, where DEVICE is a serial "
+                           "device name, \"sim\" or \"sim-pty\"");
   }
 
-  RadioCLI cli(argv[1]);
+  RadioCLI cli(argv[argc - 1], record_path, listen_path);
 
   cli.run();
 }
@@ -0,0 +1,162 @@
+#include <oceanus.h>
+#include <commands.h>
+#include <session.h>
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+using namespace Oceanus;
+
+// Replays a session recorded with radio-cli --record through Radio.
+// The module's side is played back by a ReplayTransport, so the frame
+// parser, response pool and call dispatch process exactly the
+// production traffic, at memory speed or, with --timed, with requests
+// and responses at their recorded times.
+//
+// The host's side is driven through the same entry points as in
+// radio-cli: a recorded GetPlayStatus starts handle_status(), which
+// sends the follow-up commands for the changes the module reports, a
+// recorded MOT_GetAppData starts handle_mot() and a GetTotalProgram
+// followed by the first GetProgramName starts get_programs().  Other
+// requests have no state handling and are sent as recorded.
+// Notifications in the recording reach the radio's notification
+// handler.  A change in the state handling therefore shows up as
+// mismatched requests or a different final state.
+
+static void
+usage()
+{
+  cerr << "usage: radio-replay [--timed] [--repeat N] [--pipeline DEPTH] FILE" << endl;
+  exit(1);
+}
+
+static bool
+is(const ReplayTransport::RecordedRequest& request, CommandType command_type, uint8_t command)
+{
+  return request.command_type == command_type && request.command == command;
+}
+
+// Run one operation to completion, returns false if it failed
+template <class T>
+static bool
+complete(Reactor& reactor, Operation<T> operation, Reactor::time_point deadline)
+{
+  if (!reactor.run_until([&] { return operation.ready(); }, deadline)) {
+    operation.cancel();
+    return false;
+  }
+  try {
+    operation.get();
+    return true;
+  }
+  catch (exception&) {
+    return false;
+  }
+}
+
+int
+main(int argc, char* argv[])
+{
+  auto speed = ReplayTransport::Fast;
+  unsigned repeat = 1;
+  unsigned pipeline_depth = 1;
+  string path;
+
+  for (int i = 1; i < argc; i++) {
+    string option = argv[i];
+    if (option == "--timed") {
+      speed = ReplayTransport::Timed;
+    } else if (option == "--repeat" && i + 1 < argc) {
+      repeat = stoul(argv[++i]);
+    } else if (option == "--pipeline" && i + 1 < argc) {
+      pipeline_depth = stoul(argv[++i]);
+    } else if (option[0] != '-' && path.empty()) {
+      path = option;
+    } else {
+      usage();
+    }
+  }
+  if (path.empty()) {
+    usage();
+  }
+
+  Session session = Session::load(path);
+
+  // Radio reports status changes on cout
+  cout.setstate(ios::badbit);
+
+  auto first_name = Commands::Stream::GetProgramName::encode(0).arguments;
+
+  for (unsigned run = 0; run < repeat; run++) {
+    Reactor reactor;
+    auto transport = make_unique<ReplayTransport>(reactor, session, speed);
+    auto& replay = *transport;
+    auto start = chrono::steady_clock::now();
+    auto deadline = start + chrono::seconds(60);
+
+    // The constructor sends the first recorded request, GetSysRdy
+    Radio radio(move(transport), reactor);
+    radio.set_pipeline_depth(pipeline_depth);
+
+    uint64_t notifications = 0;
+    uint64_t state_changes = 0;
+    radio.on_notification([&](uint16_t) { notifications++; });
+    radio.on_state_change([&](const Radio::State&, uint16_t) { state_changes++; });
+
+    auto& requests = replay.requests();
+    uint64_t operations = 0;
+    uint64_t failed = 0;
+    while (replay.requests_sent() < requests.size() && chrono::steady_clock::now() < deadline) {
+      size_t next = replay.requests_sent();
+      auto& request = requests[next];
+      if (speed == ReplayTransport::Timed) {
+        reactor.run_until([] { return false; }, min(deadline, start + chrono::nanoseconds(request.time)));
+      }
+
+      bool succeeded;
+      if (is(request, STREAM, STREAM_GetPlayStatus)) {
+        succeeded = complete(reactor, radio.async_handle_status(), deadline);
+      } else if (is(request, MOT, MOT_GetAppData)) {
+        succeeded = complete(reactor, radio.async_handle_mot(), deadline);
+      } else if (is(request, STREAM, STREAM_GetTotalProgram) && next + 1 < requests.size()
+                 && is(requests[next + 1], STREAM, STREAM_GetProgramName)
+                 && requests[next + 1].arguments.size() == first_name.size()
+                 && !memcmp(requests[next + 1].arguments.data(), first_name.data(), first_name.size())) {
+        succeeded = complete(reactor, radio.async_get_programs(), deadline);
+      } else {
+        // Also when an entry point above did not send anything, so that
+        // the replay always moves on
+        succeeded = false;
+      }
+      if (replay.requests_sent() == next) {
+        Radio::Command command = { request.command_type, request.command, request.arguments };
+        bool done = false;
+        radio.submit(command, [&](response_ptr, exception_ptr error) {
+          done = true;
+          succeeded = !error;
+        });
+        reactor.run_until([&] { return done; }, deadline);
+      }
+      operations++;
+      failed += !succeeded;
+    }
+    reactor.run_until([&] { return replay.finished(); }, deadline);
+    // Including what the radio has yet to read of the last chunks
+    while (reactor.run_once(chrono::steady_clock::now())) {
+    }
+
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    auto state = radio.state();
+    auto programs = radio.program_list();
+    cerr << path << ": " << replay.requests_sent() << " of " << requests.size() << " requests in "
+         << elapsed.count() * 1e3 << " ms (" << replay.requests_sent() / elapsed.count() << " requests/s), "
+         << operations << " operations, " << failed << " failed, " << replay.mismatches() << " mismatched, "
+         << radio.get_discarded_bytes() << " bytes discarded" << endl;
+    cerr << path << ": " << notifications << " notifications, " << state_changes << " state changes, "
+         << "final state version " << state.version << ", play status " << state.play_status
+         << ", program \"" << state.program_name << "\", " << (programs ? programs->size() : 0) << " programs"
+         << endl;
+  }
+}
@@ -0,0 +1,100 @@
+#include <flight_recorder.h>
+#include <commands.h>
+
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+using namespace std;
+using namespace Oceanus;
+
+// Decoder for flight recorder dumps
+
+static void
+print_time(uint64_t timestamp)
+{
+  time_t seconds = timestamp / 1000000000;
+  struct tm local;
+  localtime_r(&seconds, &local);
+  char buffer[32];
+  strftime(buffer, sizeof buffer, "%F %T", &local);
+  cout << buffer << '.' << setw(6) << setfill('0') << timestamp % 1000000000 / 1000 << setfill(' ');
+}
+
+static void
+print_record(const FlightRecorder::Record& record, const uint8_t* data)
+{
+  print_time(record.timestamp);
+
+  switch (record.direction) {
+  case FlightRecorder::Sent:
+  case FlightRecorder::Received:
+    cout << (record.direction == FlightRecorder::Sent ? " > " : " < ");
+    if (record.captured < 7) {
+      cout << "(short frame)";
+      break;
+    }
+    cout << command_name(data[1], data[2]) << " seq " << (unsigned) data[3]
+         << " [" << record.length - 7 << "]" << hex;
+    for (unsigned i = 6; i < record.captured && i < record.length - 1; i++) {
+      cout << ' ' << setw(2) << setfill('0') << (unsigned) data[i];
+    }
+    cout << dec << setfill(' ');
+    if (record.captured < record.length) {
+      cout << " ...";
+    }
+    break;
+  case FlightRecorder::Timeout:
+    cout << " ! timeout";
+    if (record.captured >= 2) {
+      cout << ' ' << command_name(data[0], data[1]);
+    }
+    break;
+  default:
+    cout << " ? record type " << (unsigned) record.direction;
+  }
+  cout << endl;
+}
+
+int
+main(int argc, char* argv[])
+{
+  if (argc != 2) {
+    cerr << "usage: radio-trace FILE" << endl;
+    return 1;
+  }
+
+  ifstream file(argv[1], ios::binary);
+  if (!file) {
+    cerr << "Cannot open " << argv[1] << endl;
+    return 1;
+  }
+
+  FlightRecorder::FileHeader header;
+  if (!file.read(reinterpret_cast<char*>(&header), sizeof header)
+      || memcmp(header.magic, FlightRecorder::magic, sizeof header.magic)) {
+    cerr << argv[1] << " is not a flight recorder dump" << endl;
+    return 1;
+  }
+  if (header.version != FlightRecorder::version || header.record_size != sizeof(FlightRecorder::Record)) {
+    cerr << "Unsupported flight recorder dump version " << header.version << endl;
+    return 1;
+  }
+
+  uint64_t remaining = header.length;
+  vector<uint8_t> data;
+  while (remaining >= sizeof(FlightRecorder::Record)) {
+    FlightRecorder::Record record;
+    file.read(reinterpret_cast<char*>(&record), sizeof record);
+    data.resize(record.captured);
+    file.read(reinterpret_cast<char*>(data.data()), record.captured);
+    if (!file) {
+      cerr << "Truncated dump" << endl;
+      return 1;
+    }
+    remaining -= sizeof record + record.captured;
+    print_record(record, data.data());
+  }
+}
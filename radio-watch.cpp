@@ -0,0 +1,65 @@
+#include <state_export.h>
+
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include <magic_enum.hpp>
+
+using namespace std;
+using namespace Oceanus;
+
+// Follows the state exported by radio-cli, or any other process using
+// Radio::export_state(), without touching the radio
+
+static void
+show(const Radio::Snapshot& snapshot, const Radio::Snapshot& previous)
+{
+  if (snapshot.play_status != previous.play_status) {
+    cout << "Play Status: " << magic_enum::enum_name(static_cast<Radio::PlayStatus>(snapshot.play_status)) << endl;
+  }
+  if (strcmp(snapshot.program_name, previous.program_name)) {
+    cout << "Program Name: " << snapshot.program_name << endl;
+  }
+  if (strcmp(snapshot.program_text, previous.program_text)) {
+    cout << "Program Text: " << snapshot.program_text << endl;
+  }
+  if (snapshot.signal_quality != previous.signal_quality) {
+    cout << "Signal Quality: " << (unsigned) snapshot.signal_quality << endl;
+  }
+}
+
+int
+main(int argc, char* argv[])
+{
+  if (argc > 2) {
+    cerr << "usage: radio-watch [FILE]" << endl;
+    return 1;
+  }
+  string path = argc == 2 ? argv[1] : "/dev/shm/radio-cli.state";
+
+  for (;;) {
+    try {
+      StateReader reader(path);
+      Radio::Snapshot previous = {};
+      uint64_t programs_version = 0;
+      while (!reader.closed()) {
+        uint32_t changes = reader.changes();
+        auto snapshot = reader.snapshot();
+        show(snapshot, previous);
+        if (snapshot.programs_version != programs_version) {
+          auto programs = reader.programs(&programs_version);
+          cout << "Programs: " << programs.size() << endl;
+        }
+        previous = snapshot;
+        reader.wait(changes, chrono::seconds(1));
+      }
+      cout << "Radio gone" << endl;
+    }
+    catch (exception& error) {
+      cerr << error.what() << endl;
+    }
+    // Wait for the radio to come back
+    this_thread::sleep_for(chrono::seconds(1));
+  }
+}
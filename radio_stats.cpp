@@ -0,0 +1,170 @@
+#include <radio_stats.h>
+#include <commands.h>
+
+#include <algorithm>
+#include <iomanip>
+
+namespace Oceanus {
+
+unsigned
+LatencyHistogram::bucket(uint64_t value)
+{
+  if (value < sub_buckets) {
+    return value;
+  }
+  unsigned exponent = 63 - __builtin_clzll(value);
+  unsigned index = (exponent - 2) * sub_buckets + ((value >> (exponent - 3)) & (sub_buckets - 1));
+  return index < buckets ? index : buckets - 1;
+}
+
+uint64_t
+LatencyHistogram::lower_bound(unsigned bucket)
+{
+  if (bucket < sub_buckets) {
+    return bucket;
+  }
+  unsigned exponent = bucket / sub_buckets + 2;
+  return (uint64_t) (sub_buckets + bucket % sub_buckets) << (exponent - 3);
+}
+
+void
+LatencyHistogram::record(uint64_t microseconds)
+{
+  RadioStats::increment(_buckets[bucket(microseconds)]);
+  RadioStats::increment(_count);
+  RadioStats::increment(_total, microseconds);
+  if (microseconds > _max.load(memory_order_relaxed)) {
+    _max.store(microseconds, memory_order_relaxed);
+  }
+}
+
+uint64_t
+LatencyHistogram::percentile(double fraction) const
+{
+  uint64_t total = count();
+  if (!total) {
+    return 0;
+  }
+  uint64_t rank = fraction * total;
+  uint64_t seen = 0;
+  for (unsigned i = 0; i < buckets; i++) {
+    seen += _buckets[i].load(memory_order_relaxed);
+    if (seen > rank) {
+      return i + 1 < buckets ? min(lower_bound(i + 1) - 1, max()) : max();
+    }
+  }
+  return max();
+}
+
+RadioStats::~RadioStats()
+{
+  for (auto& slot : _commands) {
+    delete slot.load();
+  }
+}
+
+RadioStats::CommandStats*
+RadioStats::entry(uint8_t command_type, uint8_t command)
+{
+  if (command_type >= command_types) {
+    return nullptr;
+  }
+  auto& slot = _commands[command_type * 256 + command];
+  CommandStats* stats = slot.load(memory_order_acquire);
+  if (!stats) {
+    stats = new CommandStats;
+    slot.store(stats, memory_order_release);
+  }
+  return stats;
+}
+
+const RadioStats::CommandStats*
+RadioStats::command(uint8_t command_type, uint8_t command) const
+{
+  if (command_type >= command_types) {
+    return nullptr;
+  }
+  return _commands[command_type * 256 + command].load(memory_order_acquire);
+}
+
+void
+RadioStats::request_sent(uint8_t command_type, uint8_t command, unsigned length)
+{
+  if (auto stats = entry(command_type, command)) {
+    increment(stats->requests);
+    increment(stats->bytes_out, length);
+  }
+}
+
+void
+RadioStats::response_received(uint8_t command_type, uint8_t command, unsigned length, bool error,
+                              chrono::steady_clock::duration latency)
+{
+  if (auto stats = entry(command_type, command)) {
+    increment(stats->responses);
+    increment(stats->bytes_in, length);
+    if (error) {
+      increment(stats->errors);
+    }
+    stats->latency.record(chrono::duration_cast<chrono::microseconds>(latency).count());
+  }
+}
+
+void
+RadioStats::timed_out(uint8_t command_type, uint8_t command)
+{
+  if (auto stats = entry(command_type, command)) {
+    increment(stats->timeouts);
+  }
+}
+
+void
+RadioStats::notification_received(unsigned length)
+{
+  increment(_notifications);
+  increment(_notification_bytes, length);
+}
+
+void
+RadioStats::dump(ostream& os) const
+{
+  ios_base::fmtflags flags(os.flags());
+
+  os << "Latencies in microseconds" << endl;
+  os << left << setw(28) << "Command" << right
+     << setw(9) << "Requests" << setw(8) << "Errors" << setw(9) << "Timeouts"
+     << setw(10) << "Out" << setw(10) << "In"
+     << setw(8) << "Mean" << setw(8) << "p50" << setw(8) << "p90" << setw(8) << "p99" << setw(8) << "Max"
+     << endl;
+
+  for (unsigned i = 0; i < _commands.size(); i++) {
+    const CommandStats* stats = _commands[i].load(memory_order_acquire);
+    if (!stats) {
+      continue;
+    }
+    auto& latency = stats->latency;
+    uint64_t responses = latency.count();
+    os << left << setw(28) << command_name(i / 256, i % 256) << right
+       << setw(9) << stats->requests.load(memory_order_relaxed)
+       << setw(8) << stats->errors.load(memory_order_relaxed)
+       << setw(9) << stats->timeouts.load(memory_order_relaxed)
+       << setw(10) << stats->bytes_out.load(memory_order_relaxed)
+       << setw(10) << stats->bytes_in.load(memory_order_relaxed)
+       << setw(8) << (responses ? latency.total() / responses : 0)
+       << setw(8) << latency.percentile(0.5)
+       << setw(8) << latency.percentile(0.9)
+       << setw(8) << latency.percentile(0.99)
+       << setw(8) << latency.max()
+       << endl;
+  }
+
+  os << "Notifications: " << notifications() << " (" << _notification_bytes.load(memory_order_relaxed) << " bytes)"
+     << ", sequence mismatches: " << sequence_mismatches()
+     << ", ready retries: " << ready_retries()
+     << ", resyncs: " << resyncs()
+     << ", discarded bytes: " << discarded_bytes() << endl;
+
+  os.flags(flags);
+}
+
+};
@@ -0,0 +1,115 @@
+// -*- C++ -*-
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+using namespace std;
+
+namespace Oceanus {
+
+// Log-linear latency histogram in microseconds.  Every power of two is
+// split into eight buckets, so recorded values are accurate to 12.5%
+// from 8 µs up to several minutes.  Values below 8 µs are exact.
+
+class LatencyHistogram
+{
+public:
+  static const unsigned sub_buckets = 8;
+  static const unsigned buckets = 26 * sub_buckets;
+
+  void record(uint64_t microseconds);
+
+  uint64_t count() const { return _count.load(memory_order_relaxed); }
+  uint64_t total() const { return _total.load(memory_order_relaxed); }
+  uint64_t max() const { return _max.load(memory_order_relaxed); }
+
+  // Upper bound of the bucket holding the given fraction of all values
+  uint64_t percentile(double fraction) const;
+
+private:
+  array<atomic<uint64_t>, buckets> _buckets{};
+  atomic<uint64_t> _count{0};
+  atomic<uint64_t> _total{0};
+  atomic<uint64_t> _max{0};
+
+  static unsigned bucket(uint64_t value);
+  static uint64_t lower_bound(unsigned bucket);
+};
+
+// Per command instrumentation of a Radio.  All counters are only
+// written on the reactor thread, so recording is a relaxed load and
+// store without any locked instructions.  They may be read from any
+// thread at any time; a dump taken while commands are completing may
+// be off by the commands in progress.
+
+class RadioStats
+{
+public:
+  struct CommandStats {
+    atomic<uint64_t> requests{0};
+    atomic<uint64_t> responses{0};
+    atomic<uint64_t> errors{0};
+    atomic<uint64_t> timeouts{0};
+    atomic<uint64_t> bytes_out{0};
+    atomic<uint64_t> bytes_in{0};
+    LatencyHistogram latency;
+  };
+
+  RadioStats() = default;
+  ~RadioStats();
+
+  RadioStats(const RadioStats&) = delete;
+  RadioStats& operator=(const RadioStats&) = delete;
+
+  void request_sent(uint8_t command_type, uint8_t command, unsigned length);
+  void response_received(uint8_t command_type, uint8_t command, unsigned length, bool error,
+                         chrono::steady_clock::duration latency);
+  void timed_out(uint8_t command_type, uint8_t command);
+  void notification_received(unsigned length);
+  void sequence_mismatch() { increment(_sequence_mismatches); }
+  void ready_retry() { increment(_ready_retries); }
+  void line_noise(uint64_t discarded_bytes, uint64_t resyncs)
+  {
+    _discarded_bytes.store(discarded_bytes, memory_order_relaxed);
+    _resyncs.store(resyncs, memory_order_relaxed);
+  }
+
+  // Statistics of one command, nullptr if it has not been used yet
+  const CommandStats* command(uint8_t command_type, uint8_t command) const;
+
+  uint64_t notifications() const { return _notifications.load(memory_order_relaxed); }
+  uint64_t sequence_mismatches() const { return _sequence_mismatches.load(memory_order_relaxed); }
+  uint64_t ready_retries() const { return _ready_retries.load(memory_order_relaxed); }
+  uint64_t discarded_bytes() const { return _discarded_bytes.load(memory_order_relaxed); }
+  uint64_t resyncs() const { return _resyncs.load(memory_order_relaxed); }
+
+  void dump(ostream& os) const;
+
+  static void increment(atomic<uint64_t>& counter, uint64_t value = 1)
+  {
+    counter.store(counter.load(memory_order_relaxed) + value, memory_order_relaxed);
+  }
+
+private:
+  // Command types are 0x00 to 0x08
+  static const unsigned command_types = 9;
+
+  // Allocated on first use of a command, never freed before destruction
+  array<atomic<CommandStats*>, command_types * 256> _commands{};
+
+  atomic<uint64_t> _notifications{0};
+  atomic<uint64_t> _notification_bytes{0};
+  atomic<uint64_t> _sequence_mismatches{0};
+  atomic<uint64_t> _ready_retries{0};
+  atomic<uint64_t> _discarded_bytes{0};
+  atomic<uint64_t> _resyncs{0};
+
+  CommandStats* entry(uint8_t command_type, uint8_t command);
+};
+
+};
@@ -0,0 +1,189 @@
+#include <reactor.h>
+
+#include <system_error>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <errno.h>
+#include <unistd.h>
+
+namespace Oceanus {
+
+Reactor::Reactor()
+  : _epoll_fd(epoll_create1(EPOLL_CLOEXEC)),
+    _event_fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+    _stopped(false),
+    _next_timer_id(1)
+{
+  if (_epoll_fd == -1 || _event_fd == -1) {
+    throw system_error(errno, generic_category(), "Cannot create reactor");
+  }
+  add(_event_fd, EPOLLIN, [this](uint32_t) { run_posted(); });
+}
+
+Reactor::~Reactor()
+{
+  close(_event_fd);
+  close(_epoll_fd);
+}
+
+void
+Reactor::add(int fd, uint32_t events, fd_handler handler)
+{
+  struct epoll_event event = {};
+  event.events = events;
+  event.data.fd = fd;
+
+  if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+    throw system_error(errno, generic_category(), "Cannot add file descriptor to reactor");
+  }
+  _fd_handlers[fd] = make_shared<fd_handler>(handler);
+}
+
+void
+Reactor::modify(int fd, uint32_t events)
+{
+  struct epoll_event event = {};
+  event.events = events;
+  event.data.fd = fd;
+
+  if (epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fd, &event) == -1) {
+    throw system_error(errno, generic_category(), "Cannot modify reactor file descriptor");
+  }
+}
+
+void
+Reactor::remove(int fd)
+{
+  if (_fd_handlers.erase(fd)) {
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+  }
+}
+
+Reactor::timer_id
+Reactor::add_timer(time_point deadline, timer_handler handler)
+{
+  timer_id id = _next_timer_id++;
+  _timers[{ deadline, id }] = handler;
+  _timer_deadlines[id] = deadline;
+  return id;
+}
+
+void
+Reactor::cancel_timer(timer_id id)
+{
+  auto i = _timer_deadlines.find(id);
+  if (i != _timer_deadlines.end()) {
+    _timers.erase({ i->second, id });
+    _timer_deadlines.erase(i);
+  }
+}
+
+void
+Reactor::post(function<void()> task)
+{
+  {
+    lock_guard<mutex> lock(_posted_mutex);
+    _posted.push_back(move(task));
+  }
+  uint64_t one = 1;
+  if (::write(_event_fd, &one, sizeof one) == -1 && errno != EAGAIN) {
+    throw system_error(errno, generic_category(), "Cannot wake up reactor");
+  }
+}
+
+void
+Reactor::run_posted()
+{
+  uint64_t count;
+  if (::read(_event_fd, &count, sizeof count) == -1 && errno != EAGAIN) {
+    throw system_error(errno, generic_category(), "Cannot read reactor event counter");
+  }
+
+  vector<function<void()>> tasks;
+  {
+    lock_guard<mutex> lock(_posted_mutex);
+    tasks.swap(_posted);
+  }
+  for (auto& task : tasks) {
+    task();
+  }
+}
+
+bool
+Reactor::dispatch_timers()
+{
+  bool dispatched = false;
+  auto now = clock::now();
+  while (!_timers.empty() && _timers.begin()->first.first <= now) {
+    auto i = _timers.begin();
+    timer_handler handler = move(i->second);
+    _timer_deadlines.erase(i->first.second);
+    _timers.erase(i);
+    handler();
+    dispatched = true;
+  }
+  return dispatched;
+}
+
+bool
+Reactor::run_once(time_point deadline)
+{
+  if (dispatch_timers()) {
+    return true;
+  }
+
+  time_point wakeup = deadline;
+  if (!_timers.empty() && _timers.begin()->first.first < wakeup) {
+    wakeup = _timers.begin()->first.first;
+  }
+
+  int timeout = -1;
+  if (wakeup != time_point::max()) {
+    auto remain = wakeup - clock::now();
+    // Round up so that we don't wake up just before the deadline
+    timeout = max<long>(0, chrono::ceil<chrono::milliseconds>(remain).count());
+  }
+
+  const int max_events = 16;
+  struct epoll_event events[max_events];
+  int count = epoll_wait(_epoll_fd, events, max_events, timeout);
+  if (count == -1) {
+    if (errno == EINTR) {
+      return false;
+    }
+    throw system_error(errno, generic_category(), "Error waiting for events");
+  }
+
+  for (int i = 0; i < count; i++) {
+    auto handler = _fd_handlers.find(events[i].data.fd);
+    if (handler != _fd_handlers.end()) {
+      // Keep the handler alive even if it removes itself
+      auto keep = handler->second;
+      (*keep)(events[i].events);
+    }
+  }
+
+  return dispatch_timers() || count > 0;
+}
+
+void
+Reactor::run()
+{
+  _loop_thread = this_thread::get_id();
+  try {
+    while (!_stopped) {
+      run_once();
+    }
+  }
+  catch (...) {
+    _loop_thread = thread::id();
+    throw;
+  }
+  _loop_thread = thread::id();
+  // Reset only once it has taken effect, so that a stop() before run()
+  // is not lost
+  _stopped = false;
+}
+
+};
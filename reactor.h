@@ -0,0 +1,102 @@
+// -*- C++ -*-
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+namespace Oceanus {
+
+// Single threaded epoll based event loop.  File descriptor handlers
+// are invoked when their descriptor becomes ready, timer handlers when
+// their deadline has passed.  Handlers may add or remove descriptors
+// and timers, and they may call run_until() recursively.  post() is
+// the only member function that may be called from other threads.
+
+class Reactor
+{
+public:
+  using clock = chrono::steady_clock;
+  using time_point = clock::time_point;
+  using fd_handler = function<void(uint32_t events)>;
+  using timer_handler = function<void()>;
+  using timer_id = uint64_t;
+
+  Reactor();
+  ~Reactor();
+
+  Reactor(const Reactor&) = delete;
+  Reactor& operator=(const Reactor&) = delete;
+
+  void add(int fd, uint32_t events, fd_handler handler);
+  void modify(int fd, uint32_t events);
+  void remove(int fd);
+
+  timer_id add_timer(time_point deadline, timer_handler handler);
+  timer_id add_timer(chrono::milliseconds delay, timer_handler handler) { return add_timer(clock::now() + delay, handler); }
+  void cancel_timer(timer_id id);
+
+  // Queue a task to be run on the reactor thread
+  void post(function<void()> task);
+
+  // True if run() is currently executing on a different thread than
+  // the caller's.  Blocking operations must then wait for the reactor
+  // thread instead of dispatching events themselves.
+  bool running_in_other_thread() const
+  {
+    thread::id loop_thread = _loop_thread;
+    return loop_thread != thread::id() && loop_thread != this_thread::get_id();
+  }
+
+  // Wait until at least one event has been dispatched or the deadline
+  // has passed.  Returns false if the deadline passed without any
+  // event being dispatched.
+  bool run_once(time_point deadline = time_point::max());
+
+  // Dispatch events until done() returns true or the deadline passes.
+  // Returns the final value of done().
+  template <class Predicate>
+  bool run_until(Predicate done, time_point deadline = time_point::max())
+  {
+    while (!done()) {
+      if (!run_once(deadline) && clock::now() >= deadline) {
+        return done();
+      }
+    }
+    return true;
+  }
+
+  // Dispatch events until stop() is called.  After a stop() from
+  // before run() was entered, run() returns right away.
+  void run();
+  void stop() { _stopped = true; post([] {}); }
+
+private:
+  int _epoll_fd;
+  int _event_fd;
+  atomic<bool> _stopped;
+  atomic<thread::id> _loop_thread;
+
+  mutex _posted_mutex;
+  vector<function<void()>> _posted;
+
+  unordered_map<int, shared_ptr<fd_handler>> _fd_handlers;
+
+  timer_id _next_timer_id;
+  map<pair<time_point, timer_id>, timer_handler> _timers;
+  unordered_map<timer_id, time_point> _timer_deadlines;
+
+  bool dispatch_timers();
+  void run_posted();
+};
+
+};
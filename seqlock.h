@@ -0,0 +1,110 @@
+// -*- C++ -*-
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+using namespace std;
+
+namespace Oceanus {
+
+// A value of trivially copyable type published by one writer thread to
+// any number of reader threads.  Neither side ever takes a lock or
+// waits for the other.  There are two copies of the value: store()
+// writes the one that readers are not directed to and then switches
+// them over, so a reader has to retry only if two stores complete
+// while it is copying.  Every copy is guarded by a sequence number
+// that is odd while the copy is being written.
+//
+// The value is held in atomic words, which makes concurrent copying
+// well defined, and the object contains no pointers, so it may also be
+// placed in memory shared between processes.
+
+template <class T>
+class SeqLock
+{
+  static_assert(is_trivially_copyable<T>::value, "SeqLock values must be trivially copyable");
+
+public:
+  SeqLock(const T& value = T()) : _stores(0)
+  {
+    for (auto& slot : _slots) {
+      slot.sequence.store(0, memory_order_relaxed);
+      copy_in(slot, value);
+    }
+  }
+
+  SeqLock(const SeqLock&) = delete;
+  SeqLock& operator=(const SeqLock&) = delete;
+
+  // Writer thread only
+  void store(const T& value)
+  {
+    uint64_t stores = _stores.load(memory_order_relaxed) + 1;
+    Slot& slot = _slots[stores & 1];
+    uint64_t sequence = slot.sequence.load(memory_order_relaxed);
+    slot.sequence.store(sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    copy_in(slot, value);
+    slot.sequence.store(sequence + 2, memory_order_release);
+    _stores.store(stores, memory_order_release);
+  }
+
+  T load() const
+  {
+    T value;
+    while (!try_load(value)) {
+    }
+    return value;
+  }
+
+  // A single attempt, which fails while a store is in progress.  For
+  // readers that must not wait for a writer that may have gone.
+  bool try_load(T& value) const
+  {
+    const Slot& slot = _slots[_stores.load(memory_order_acquire) & 1];
+    uint64_t sequence = slot.sequence.load(memory_order_acquire);
+    if (sequence & 1) {
+      return false;
+    }
+    uint64_t buffer[words];
+    for (size_t i = 0; i < words; i++) {
+      buffer[i] = slot.data[i].load(memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_acquire);
+    if (slot.sequence.load(memory_order_relaxed) != sequence) {
+      return false;
+    }
+    memcpy(&value, buffer, sizeof value);
+    return true;
+  }
+
+  // Number of stores so far, to tell whether there is anything new
+  uint64_t stores() const { return _stores.load(memory_order_acquire); }
+
+private:
+  static constexpr size_t words = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+  struct Slot {
+    atomic<uint64_t> sequence;
+    array<atomic<uint64_t>, words> data;
+  };
+
+  atomic<uint64_t> _stores;
+  Slot _slots[2];
+
+  static void copy_in(Slot& slot, const T& value)
+  {
+    uint64_t buffer[words] = {};
+    memcpy(buffer, &value, sizeof value);
+    for (size_t i = 0; i < words; i++) {
+      slot.data[i].store(buffer[i], memory_order_relaxed);
+    }
+  }
+};
+
+};
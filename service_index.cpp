@@ -0,0 +1,263 @@
+#include <service_index.h>
+
+#include <algorithm>
+#include <cctype>
+
+namespace Oceanus {
+
+static inline bool
+separator(char c)
+{
+  // Only ASCII punctuation and white space separate words, bytes of
+  // multi byte UTF-8 sequences never do
+  return (unsigned char) c < 0x80 && !isalnum((unsigned char) c);
+}
+
+static void
+remove_id(vector<uint32_t>& ids, uint32_t id)
+{
+  ids.erase(remove(ids.begin(), ids.end(), id), ids.end());
+}
+
+string
+ServiceIndex::normalize(string_view text)
+{
+  string normalized(text);
+  for (auto& c : normalized) {
+    if (c >= 'A' && c <= 'Z') {
+      c += 'a' - 'A';
+    }
+  }
+  return normalized;
+}
+
+template <class F>
+void
+ServiceIndex::for_each_word(const string& name, F action) const
+{
+  for (size_t i = 0; i < name.size(); i++) {
+    if (!separator(name[i]) && (i == 0 || separator(name[i - 1]))) {
+      action(i);
+    }
+  }
+}
+
+uint32_t
+ServiceIndex::child(uint32_t node, char c) const
+{
+  auto& children = _trie[node].children;
+  auto child = lower_bound(children.begin(), children.end(), make_pair(c, (uint32_t) 0));
+  return child != children.end() && child->first == c ? child->second : 0;
+}
+
+void
+ServiceIndex::add_name(uint32_t id, const string& name)
+{
+  if (_trie.empty()) {
+    _trie.emplace_back();
+  }
+  for_each_word(name, [&](size_t start) {
+    uint32_t node = 0;
+    for (size_t i = start; i < name.size(); i++) {
+      uint32_t next = child(node, name[i]);
+      if (!next) {
+        next = _trie.size();
+        auto& children = _trie[node].children;
+        children.insert(lower_bound(children.begin(), children.end(), make_pair(name[i], (uint32_t) 0)),
+                        { name[i], next });
+        _trie.emplace_back();
+      }
+      node = next;
+      // The words of one name are added one after the other, so a
+      // name passing through a node twice would follow itself
+      auto& services = _trie[node].services;
+      if (services.empty() || services.back() != id) {
+        services.push_back(id);
+      }
+    }
+  });
+}
+
+void
+ServiceIndex::remove_name(uint32_t id, const string& name)
+{
+  for_each_word(name, [&](size_t start) {
+    uint32_t node = 0;
+    for (size_t i = start; i < name.size() && (node = child(node, name[i])); i++) {
+      remove_id(_trie[node].services, id);
+    }
+  });
+}
+
+void
+ServiceIndex::add_details(uint32_t id, const ProgramInfo& info)
+{
+  if (info.ensemble.size()) {
+    _by_ensemble[normalize(info.ensemble)].push_back(id);
+  }
+  if (info.details) {
+    _by_program_type[info.program_type].push_back(id);
+    _by_frequency[info.frequency_index].push_back(id);
+    _by_ecc[info.ecc].push_back(id);
+  }
+}
+
+void
+ServiceIndex::remove_details(uint32_t id, const ProgramInfo& info)
+{
+  if (info.ensemble.size()) {
+    remove_id(_by_ensemble[normalize(info.ensemble)], id);
+  }
+  if (info.details) {
+    remove_id(_by_program_type[info.program_type], id);
+    remove_id(_by_frequency[info.frequency_index], id);
+    remove_id(_by_ecc[info.ecc], id);
+  }
+}
+
+void
+ServiceIndex::set(unsigned source, uint32_t index, const ProgramInfo& info)
+{
+  uint64_t key = (uint64_t) source << 32 | index;
+  auto existing = _ids.find(key);
+  if (existing == _ids.end()) {
+    uint32_t id = _services.size();
+    _ids[key] = id;
+    _services.push_back({ source, index, info });
+    add_name(id, normalize(info.name));
+    add_details(id, info);
+    return;
+  }
+
+  uint32_t id = existing->second;
+  auto& service = _services[id];
+  if (service.info.name != info.name) {
+    remove_name(id, normalize(service.info.name));
+    add_name(id, normalize(info.name));
+  }
+  remove_details(id, service.info);
+  add_details(id, info);
+  service.info = info;
+}
+
+void
+ServiceIndex::remove_source(unsigned source)
+{
+  // Rare enough to simply rebuild the index from the remaining services
+  vector<Service> services;
+  for (auto& service : _services) {
+    if (service.source != source) {
+      services.push_back(move(service));
+    }
+  }
+  clear();
+  for (auto& service : services) {
+    set(service.source, service.index, service.info);
+  }
+}
+
+void
+ServiceIndex::clear()
+{
+  _services.clear();
+  _ids.clear();
+  _trie.clear();
+  _by_ensemble.clear();
+  _by_program_type.clear();
+  _by_frequency.clear();
+  _by_ecc.clear();
+}
+
+const ServiceIndex::Node*
+ServiceIndex::lookup(const string& key) const
+{
+  if (_trie.empty()) {
+    return nullptr;
+  }
+  uint32_t node = 0;
+  for (char c : key) {
+    if (!(node = child(node, c))) {
+      return nullptr;
+    }
+  }
+  return &_trie[node];
+}
+
+bool
+ServiceIndex::matches(const Service& service, const Filter& filter, const string& ensemble) const
+{
+  auto& info = service.info;
+  return (!filter.source || service.source == *filter.source)
+    && (!filter.ensemble || normalize(info.ensemble) == ensemble)
+    && (!filter.program_type || (info.details && info.program_type == *filter.program_type))
+    && (!filter.frequency_index || (info.details && info.frequency_index == *filter.frequency_index))
+    && (!filter.ecc || (info.details && info.ecc == *filter.ecc));
+}
+
+vector<const ServiceIndex::Service*>
+ServiceIndex::collect(const id_list& ids, const Filter& filter) const
+{
+  string ensemble = filter.ensemble ? normalize(*filter.ensemble) : string();
+  vector<const Service*> found;
+  for (auto id : ids) {
+    if (matches(_services[id], filter, ensemble)) {
+      found.push_back(&_services[id]);
+    }
+  }
+  sort(found.begin(), found.end(), [](const Service* a, const Service* b) {
+    return make_pair(a->source, a->index) < make_pair(b->source, b->index);
+  });
+  return found;
+}
+
+vector<const ServiceIndex::Service*>
+ServiceIndex::find_prefix(string_view prefix, const Filter& filter) const
+{
+  if (prefix.empty()) {
+    return find(filter);
+  }
+  auto node = lookup(normalize(prefix));
+  if (!node) {
+    return {};
+  }
+  return collect(node->services, filter);
+}
+
+vector<const ServiceIndex::Service*>
+ServiceIndex::find(const Filter& filter) const
+{
+  // Start from the smallest of the applicable indexes, the other
+  // criteria are checked service by service
+  static const id_list none;
+  const id_list* candidates = nullptr;
+  auto narrow = [&](const auto& index, const auto& key) {
+    auto entry = index.find(key);
+    const id_list* ids = entry == index.end() ? &none : &entry->second;
+    if (!candidates || ids->size() < candidates->size()) {
+      candidates = ids;
+    }
+  };
+  if (filter.ensemble) {
+    narrow(_by_ensemble, normalize(*filter.ensemble));
+  }
+  if (filter.program_type) {
+    narrow(_by_program_type, *filter.program_type);
+  }
+  if (filter.frequency_index) {
+    narrow(_by_frequency, *filter.frequency_index);
+  }
+  if (filter.ecc) {
+    narrow(_by_ecc, *filter.ecc);
+  }
+
+  if (candidates) {
+    return collect(*candidates, filter);
+  }
+  id_list all(_services.size());
+  for (uint32_t id = 0; id < all.size(); id++) {
+    all[id] = id;
+  }
+  return collect(all, filter);
+}
+
+};
@@ -0,0 +1,91 @@
+// -*- C++ -*-
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <program_database.h>
+
+using namespace std;
+
+namespace Oceanus {
+
+// Lookup of programs by name prefix, ensemble, programme type,
+// frequency and country, across the program lists of one or more
+// modules.  A prefix trie over the names and every word within them
+// answers prefix queries in time proportional to the prefix plus the
+// number of matches; hash indexes answer the exact match filters.
+// Matching is case insensitive for ASCII letters.
+
+class ServiceIndex
+{
+public:
+  struct Service {
+    unsigned source;        // the module, when indexing several
+    uint32_t index;         // in that module's program list
+    ProgramInfo info;
+  };
+
+  // Criteria that are not set match every service.  The programme
+  // type, frequency and country criteria only match services whose
+  // details are known.
+  struct Filter {
+    optional<unsigned> source;
+    optional<string> ensemble;
+    optional<uint8_t> program_type;
+    optional<uint8_t> frequency_index;
+    optional<uint8_t> ecc;
+  };
+
+  // Add a service, or replace the one with the same source and index
+  void set(unsigned source, uint32_t index, const ProgramInfo& info);
+  void remove_source(unsigned source);
+  void clear();
+
+  size_t size() const { return _services.size(); }
+
+  // Lookups return services ordered by source and index.  The
+  // pointers stay valid until the index is next changed.
+
+  // Services whose name, or a word in it, starts with prefix
+  vector<const Service*> find_prefix(string_view prefix, const Filter& filter = {}) const;
+  vector<const Service*> find(const Filter& filter) const;
+
+  static string normalize(string_view text);
+
+private:
+  struct Node {
+    vector<pair<char, uint32_t>> children;  // sorted by character
+    vector<uint32_t> services;              // whose names pass through here
+  };
+
+  using id_list = vector<uint32_t>;
+
+  vector<Service> _services;
+  unordered_map<uint64_t, uint32_t> _ids;   // by source << 32 | index
+
+  vector<Node> _trie;                       // the root is the first node
+  unordered_map<string, id_list> _by_ensemble;
+  unordered_map<uint8_t, id_list> _by_program_type;
+  unordered_map<uint8_t, id_list> _by_frequency;
+  unordered_map<uint8_t, id_list> _by_ecc;
+
+  void add_name(uint32_t id, const string& name);
+  void remove_name(uint32_t id, const string& name);
+  void add_details(uint32_t id, const ProgramInfo& info);
+  void remove_details(uint32_t id, const ProgramInfo& info);
+
+  template <class F> void for_each_word(const string& name, F action) const;
+  uint32_t child(uint32_t node, char c) const;   // 0 if there is none
+  const Node* lookup(const string& key) const;
+  bool matches(const Service& service, const Filter& filter, const string& ensemble) const;
+  vector<const Service*> collect(const id_list& ids, const Filter& filter) const;
+};
+
+};
@@ -0,0 +1,237 @@
+#include <session.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace Oceanus {
+
+Session
+Session::load(const string& path)
+{
+  ifstream file(path, ios::binary);
+  if (!file) {
+    throw invalid_argument("Cannot open session file " + path);
+  }
+
+  FileHeader header;
+  if (!file.read(reinterpret_cast<char*>(&header), sizeof header) || memcmp(header.magic, magic, sizeof magic)) {
+    throw invalid_argument(path + " is not a session recording");
+  }
+  if (header.version != version) {
+    throw invalid_argument("Unsupported session recording version " + to_string(header.version));
+  }
+
+  Session session;
+  Record record;
+  while (file.read(reinterpret_cast<char*>(&record), sizeof record)) {
+    Chunk chunk = { record.time, record.direction, vector<uint8_t>(record.length) };
+    if (!file.read(reinterpret_cast<char*>(chunk.data.data()), record.length)) {
+      throw invalid_argument("Truncated session recording " + path);
+    }
+    session.chunks.push_back(move(chunk));
+  }
+  return session;
+}
+
+RecordingTransport::RecordingTransport(Reactor& reactor, unique_ptr<Transport> transport, const string& path)
+  : Transport(reactor, transport->name() + " (recording to " + path + ")"),
+    _transport(move(transport)),
+    _file(path, ios::binary | ios::trunc),
+    _start(Reactor::clock::now())
+{
+  if (!_file) {
+    throw invalid_argument("Cannot create session file " + path);
+  }
+  Session::FileHeader header = {};
+  memcpy(header.magic, Session::magic, sizeof header.magic);
+  header.version = Session::version;
+  _file.write(reinterpret_cast<const char*>(&header), sizeof header);
+
+  _transport->on_readable([this]() {
+    if (_readable) {
+      _readable();
+    }
+  });
+}
+
+void
+RecordingTransport::record(Session::Direction direction, const uint8_t* data, size_t length)
+{
+  Session::Record record = {};
+  record.time = chrono::duration_cast<chrono::nanoseconds>(Reactor::clock::now() - _start).count();
+  record.length = length;
+  record.direction = direction;
+  _file.write(reinterpret_cast<const char*>(&record), sizeof record);
+  _file.write(reinterpret_cast<const char*>(data), length);
+  // Keep the recording complete even if the process dies
+  _file.flush();
+}
+
+size_t
+RecordingTransport::read(uint8_t* buffer, size_t length)
+{
+  size_t count = _transport->read(buffer, length);
+  if (count) {
+    record(Session::Received, buffer, count);
+  }
+  return count;
+}
+
+size_t
+RecordingTransport::write(const uint8_t* buffer, size_t length)
+{
+  size_t count = _transport->write(buffer, length);
+  if (count) {
+    record(Session::Sent, buffer, count);
+  }
+  return count;
+}
+
+ReplayTransport::ReplayTransport(Reactor& reactor, const Session& session, Speed speed)
+  : LoopbackTransport(reactor, "replay"),
+    _speed(speed),
+    _host_parser(Packet::max_payload),
+    _next_chunk(0),
+    _requests_sent(0),
+    _mismatches(0),
+    _start(Reactor::clock::now()),
+    _last_request(_start)
+{
+  load(session);
+  set_peer([this](const uint8_t* data, size_t length) { receive(data, length); });
+  release();
+}
+
+ReplayTransport::~ReplayTransport()
+{
+  for (auto id : _timers) {
+    _reactor.cancel_timer(id);
+  }
+}
+
+// Feed a byte stream through a frame parser, reporting each frame with
+// its offset in the stream
+template <class F>
+static void
+parse_frames(FrameParser& parser, uint64_t& offset, const vector<uint8_t>& data, F handle_frame)
+{
+  size_t consumed = 0;
+  while (consumed < data.size()) {
+    size_t available;
+    uint8_t* space = parser.write_space(available);
+    size_t count = min(available, data.size() - consumed);
+    memcpy(space, data.data() + consumed, count);
+    parser.commit(count);
+    consumed += count;
+    offset += count;
+
+    FrameView frame;
+    while (parser.next(frame)) {
+      handle_frame(frame, offset - parser.buffered() - frame.length);
+    }
+  }
+}
+
+void
+ReplayTransport::load(const Session& session)
+{
+  FrameParser sent_parser(Packet::max_payload);
+  FrameParser received_parser(Packet::max_payload);
+  uint64_t sent_offset = 0;
+  uint64_t received_offset = 0;
+  uint64_t request_time = 0;
+
+  // Sequence numbers may belong to a frame that started in an earlier
+  // chunk, so they are located by their offset in the received stream
+  vector<uint64_t> chunk_offsets;
+  vector<uint64_t> sequence_offsets;
+
+  for (auto& chunk : session.chunks) {
+    if (chunk.direction == Session::Sent) {
+      parse_frames(sent_parser, sent_offset, chunk.data, [&](const FrameView& frame, uint64_t) {
+        RecordedRequest request;
+        request.command_type = static_cast<CommandType>(frame.command_type());
+        request.command = frame.command();
+        request.sequence_number = frame.sequence_number();
+        request.time = chunk.time;
+        request.arguments.append(frame.payload(), min(frame.payload_length(), Arguments::capacity));
+        _requests.push_back(request);
+      });
+      request_time = chunk.time;
+    } else {
+      chunk_offsets.push_back(received_offset);
+      _chunks.push_back({ chunk.time, _requests.size(), request_time, chunk.data, {} });
+      parse_frames(received_parser, received_offset, chunk.data, [&](const FrameView&, uint64_t offset) {
+        sequence_offsets.push_back(offset + 3);
+      });
+    }
+  }
+
+  for (auto offset : sequence_offsets) {
+    size_t i = upper_bound(chunk_offsets.begin(), chunk_offsets.end(), offset) - chunk_offsets.begin() - 1;
+    _chunks[i].sequence_numbers.push_back(offset - chunk_offsets[i]);
+  }
+}
+
+void
+ReplayTransport::receive(const uint8_t* data, size_t length)
+{
+  vector<uint8_t> bytes(data, data + length);
+  uint64_t offset = 0;
+  parse_frames(_host_parser, offset, bytes, [&](const FrameView& frame, uint64_t) {
+    if (_requests_sent < _requests.size()) {
+      auto& recorded = _requests[_requests_sent];
+      if (recorded.command_type != frame.command_type() || recorded.command != frame.command()) {
+        _mismatches++;
+      }
+      _sequence_map[recorded.sequence_number] = frame.sequence_number();
+    } else {
+      _mismatches++;
+    }
+    _requests_sent++;
+  });
+  _last_request = Reactor::clock::now();
+  release();
+}
+
+void
+ReplayTransport::release()
+{
+  while (_next_chunk < _chunks.size() && _chunks[_next_chunk].requests_before <= _requests_sent) {
+    const Chunk& chunk = _chunks[_next_chunk++];
+    if (_speed == Fast) {
+      deliver_chunk(chunk);
+      continue;
+    }
+
+    auto base = chunk.requests_before ? _last_request : _start;
+    auto due = base + chrono::nanoseconds(chunk.time - chunk.request_time);
+    auto id = make_shared<Reactor::timer_id>();
+    *id = _reactor.add_timer(due, [this, id, &chunk]() {
+      _timers.erase(*id);
+      deliver_chunk(chunk);
+    });
+    _timers.insert(*id);
+  }
+}
+
+void
+ReplayTransport::deliver_chunk(const Chunk& chunk)
+{
+  if (chunk.sequence_numbers.empty()) {
+    deliver(chunk.data.data(), chunk.data.size());
+    return;
+  }
+
+  vector<uint8_t> data = chunk.data;
+  for (auto offset : chunk.sequence_numbers) {
+    auto mapped = _sequence_map.find(data[offset]);
+    if (mapped != _sequence_map.end()) {
+      data[offset] = mapped->second;
+    }
+  }
+  deliver(data.data(), data.size());
+}
+
+};
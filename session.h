@@ -0,0 +1,140 @@
+// -*- C++ -*-
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <oceanus.h>
+#include <transport.h>
+
+using namespace std;
+
+namespace Oceanus {
+
+// A recorded session with a module: every chunk of bytes written to
+// and read from the transport, with its time since the start of the
+// session.  Recording happens below the frame parser, so line noise
+// and partial reads are preserved.
+
+struct Session
+{
+  enum Direction : uint8_t {
+    Sent     = 0,
+    Received = 1
+  };
+
+  struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+  };
+
+  struct Record {
+    uint64_t time;          // nanoseconds since the start of the session
+    uint32_t length;        // bytes of data that follow
+    Direction direction;
+    uint8_t reserved[3];
+  };
+
+  struct Chunk {
+    uint64_t time;
+    Direction direction;
+    vector<uint8_t> data;
+  };
+
+  static constexpr char magic[8] = { 'T', '4', 'B', 'S', 'E', 'S', 'S', 'N' };
+  static const uint32_t version = 1;
+
+  vector<Chunk> chunks;
+
+  static Session load(const string& path);
+};
+
+// Passes everything through to another transport and records it
+class RecordingTransport
+  : public Transport
+{
+public:
+  RecordingTransport(Reactor& reactor, unique_ptr<Transport> transport, const string& path);
+
+  size_t read(uint8_t* buffer, size_t length) override;
+  size_t write(const uint8_t* buffer, size_t length) override;
+  bool wait_writable(Reactor::time_point deadline) override { return _transport->wait_writable(deadline); }
+
+private:
+  unique_ptr<Transport> _transport;
+  ofstream _file;
+  Reactor::time_point _start;
+
+  void record(Session::Direction direction, const uint8_t* data, size_t length);
+};
+
+// Plays the module's side of a recorded session.  The host is expected
+// to send the recorded requests in the recorded order.  Received data
+// that followed the n-th recorded request becomes readable once the
+// host has sent its n-th request: at once in Fast mode, or after the
+// recorded delay in Timed mode.  Sequence numbers of the replayed
+// frames are rewritten to those of the host's requests, so replay
+// works regardless of the host's sequence counter.
+
+class ReplayTransport
+  : public LoopbackTransport
+{
+public:
+  enum Speed {
+    Fast,
+    Timed
+  };
+
+  ReplayTransport(Reactor& reactor, const Session& session, Speed speed);
+  ~ReplayTransport();
+
+  // The requests in the recording, in order
+  struct RecordedRequest {
+    CommandType command_type;
+    uint8_t command;
+    uint8_t sequence_number;
+    uint64_t time;
+    Arguments arguments;
+  };
+  const vector<RecordedRequest>& requests() const { return _requests; }
+
+  uint64_t requests_sent() const { return _requests_sent; }
+  uint64_t mismatches() const { return _mismatches; }
+  bool finished() const { return _next_chunk == _chunks.size(); }
+
+private:
+  struct Chunk {
+    uint64_t time;
+    uint64_t requests_before;       // recorded requests preceding this chunk
+    uint64_t request_time;          // time of the last of them
+    vector<uint8_t> data;
+    vector<size_t> sequence_numbers; // offsets of frame sequence numbers in data
+  };
+
+  Speed _speed;
+  vector<Chunk> _chunks;
+  vector<RecordedRequest> _requests;
+  map<uint8_t, uint8_t> _sequence_map; // recorded to host
+  FrameParser _host_parser;
+
+  size_t _next_chunk;
+  uint64_t _requests_sent;
+  uint64_t _mismatches;
+  Reactor::time_point _start;
+  Reactor::time_point _last_request;
+  set<Reactor::timer_id> _timers;
+
+  void load(const Session& session);
+  void receive(const uint8_t* data, size_t length);
+  void release();
+  void deliver_chunk(const Chunk& chunk);
+};
+
+};
@@ -0,0 +1,282 @@
+#include <state_export.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace Oceanus {
+
+constexpr char StateExport::magic[8];
+constexpr chrono::milliseconds StateReader::_read_timeout;
+
+static_assert(sizeof(StateExport::Program) % sizeof(uint64_t) == 0, "Programs are stored as whole words");
+static_assert(sizeof(StateExport::Header) % sizeof(uint64_t) == 0, "The program table must be aligned");
+static_assert(atomic<uint32_t>::is_always_lock_free && atomic<uint64_t>::is_always_lock_free,
+              "Atomics in shared memory must be lock free");
+
+static const size_t program_words = sizeof(StateExport::Program) / sizeof(uint64_t);
+
+// The program table follows the header
+static atomic<uint64_t>*
+table(StateExport::Header* header)
+{
+  return reinterpret_cast<atomic<uint64_t>*>(header + 1);
+}
+
+static const atomic<uint64_t>*
+table(const StateExport::Header* header)
+{
+  return reinterpret_cast<const atomic<uint64_t>*>(header + 1);
+}
+
+static size_t
+segment_length(uint32_t program_capacity)
+{
+  return sizeof(StateExport::Header) + (size_t) program_capacity * sizeof(StateExport::Program);
+}
+
+// The futex word is shared between processes, so the operations must
+// not be FUTEX_PRIVATE
+static void
+futex_wake(const atomic<uint32_t>& word)
+{
+  syscall(SYS_futex, &word, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+static void
+futex_wait(const atomic<uint32_t>& word, uint32_t value, chrono::nanoseconds timeout)
+{
+  struct timespec relative = { (time_t) (timeout.count() / 1000000000), (long) (timeout.count() % 1000000000) };
+  syscall(SYS_futex, &word, FUTEX_WAIT, value, &relative, nullptr, 0);
+}
+
+StateExport::StateExport(const string& path, uint32_t program_capacity)
+  : _path(path),
+    _header(nullptr),
+    _length(segment_length(program_capacity))
+{
+  // Set up a new segment and rename it over the old one, which readers
+  // may still have mapped
+  string temporary = _path + ".new";
+  int fd = open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    throw runtime_error("Cannot create state export " + temporary + ": " + strerror(errno));
+  }
+  void* map = MAP_FAILED;
+  if (ftruncate(fd, _length) == 0) {
+    map = mmap(nullptr, _length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  int error = errno;
+  close(fd);
+  if (map == MAP_FAILED) {
+    unlink(temporary.c_str());
+    throw runtime_error("Cannot map state export " + temporary + ": " + strerror(error));
+  }
+
+  _header = new (map) Header;
+  memcpy(_header->magic, magic, sizeof magic);
+  _header->version = version;
+  _header->program_capacity = program_capacity;
+  _header->length = _length;
+  _header->changes.store(0, memory_order_relaxed);
+  _header->closed.store(0, memory_order_relaxed);
+  _header->programs_sequence.store(0, memory_order_relaxed);
+  _header->programs_version.store(0, memory_order_relaxed);
+  _header->program_count.store(0, memory_order_relaxed);
+  new (table(_header)) atomic<uint64_t>[(size_t) program_capacity * program_words]();
+
+  if (rename(temporary.c_str(), _path.c_str()) < 0) {
+    error = errno;
+    munmap(_header, _length);
+    unlink(temporary.c_str());
+    throw runtime_error("Cannot replace state export " + _path + ": " + strerror(error));
+  }
+}
+
+StateExport::~StateExport()
+{
+  _header->closed.store(1, memory_order_release);
+  changed();
+  munmap(_header, _length);
+}
+
+void
+StateExport::changed()
+{
+  _header->changes.store(_header->changes.load(memory_order_relaxed) + 1, memory_order_release);
+  futex_wake(_header->changes);
+}
+
+void
+StateExport::publish(const Radio::Snapshot& snapshot)
+{
+  _header->state.store(snapshot);
+  changed();
+}
+
+void
+StateExport::publish(const vector<ProgramInfo>& programs, uint64_t programs_version)
+{
+  uint64_t count = min<uint64_t>(programs.size(), _header->program_capacity);
+  uint64_t sequence = _header->programs_sequence.load(memory_order_relaxed);
+  _header->programs_sequence.store(sequence + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  auto words = table(_header);
+  for (uint64_t i = 0; i < count; i++) {
+    auto& info = programs[i];
+    Program program = {};
+    copy_utf8(info.name, program.name, sizeof program.name);
+    copy_utf8(info.ensemble, program.ensemble, sizeof program.ensemble);
+    program.program_type = info.program_type;
+    program.frequency_index = info.frequency_index;
+    program.ecc = info.ecc;
+    program.country = info.country;
+    program.details = info.details;
+
+    uint64_t buffer[program_words];
+    memcpy(buffer, &program, sizeof program);
+    for (size_t j = 0; j < program_words; j++) {
+      words[i * program_words + j].store(buffer[j], memory_order_relaxed);
+    }
+  }
+  _header->program_count.store(count, memory_order_relaxed);
+  _header->programs_version.store(programs_version, memory_order_relaxed);
+  _header->programs_sequence.store(sequence + 2, memory_order_release);
+  changed();
+}
+
+StateReader::StateReader(const string& path)
+  : _header(nullptr),
+    _length(0)
+{
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw runtime_error("Cannot open state export " + path + ": " + strerror(errno));
+  }
+  struct stat status;
+  void* map = MAP_FAILED;
+  if (fstat(fd, &status) == 0 && (size_t) status.st_size >= sizeof(StateExport::Header)) {
+    map = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (map == MAP_FAILED) {
+    throw runtime_error("Cannot map state export " + path);
+  }
+  _header = static_cast<const StateExport::Header*>(map);
+  _length = status.st_size;
+
+  if (memcmp(_header->magic, StateExport::magic, sizeof StateExport::magic) || _header->version != StateExport::version
+      || _header->length != _length || segment_length(_header->program_capacity) > _length) {
+    munmap(const_cast<StateExport::Header*>(_header), _length);
+    throw runtime_error("Not a state export: " + path);
+  }
+}
+
+StateReader::~StateReader()
+{
+  munmap(const_cast<StateExport::Header*>(_header), _length);
+}
+
+// A copy is normally consistent at the first or second attempt.  A
+// writer that died while publishing leaves its sequence number odd for
+// good, so attempts back off and eventually give up.
+template <class F>
+void
+StateReader::retry(F attempt)
+{
+  const unsigned spins = 64;
+  auto deadline = chrono::steady_clock::now() + _read_timeout;
+  chrono::microseconds pause(1);
+  for (unsigned attempts = 1; !attempt(); attempts++) {
+    if (attempts < spins) {
+      continue;
+    }
+    if (chrono::steady_clock::now() >= deadline) {
+      throw runtime_error("State export not consistent, the exporting process may have died while writing it");
+    }
+    this_thread::sleep_for(pause);
+    pause = min(pause * 2, chrono::microseconds(1000));
+  }
+}
+
+Radio::Snapshot
+StateReader::snapshot() const
+{
+  Radio::Snapshot snapshot;
+  retry([&]() { return _header->state.try_load(snapshot); });
+  return snapshot;
+}
+
+vector<ProgramInfo>
+StateReader::programs(uint64_t* programs_version) const
+{
+  // The table only changes with the program list, so copying it again
+  // is rarely necessary
+  vector<StateExport::Program> table_copy;
+  uint64_t version;
+  retry([&]() {
+    uint64_t sequence = _header->programs_sequence.load(memory_order_acquire);
+    if (sequence & 1) {
+      return false;
+    }
+    uint64_t count = min<uint64_t>(_header->program_count.load(memory_order_relaxed), _header->program_capacity);
+    version = _header->programs_version.load(memory_order_relaxed);
+    table_copy.resize(count);
+    auto words = table(_header);
+    for (uint64_t i = 0; i < count; i++) {
+      uint64_t buffer[program_words];
+      for (size_t j = 0; j < program_words; j++) {
+        buffer[j] = words[i * program_words + j].load(memory_order_relaxed);
+      }
+      memcpy(&table_copy[i], buffer, sizeof buffer);
+    }
+    atomic_thread_fence(memory_order_acquire);
+    return _header->programs_sequence.load(memory_order_relaxed) == sequence;
+  });
+
+  vector<ProgramInfo> programs(table_copy.size());
+  for (size_t i = 0; i < table_copy.size(); i++) {
+    auto& program = table_copy[i];
+    auto& info = programs[i];
+    info.name.assign(program.name, strnlen(program.name, sizeof program.name));
+    info.ensemble.assign(program.ensemble, strnlen(program.ensemble, sizeof program.ensemble));
+    info.program_type = program.program_type;
+    info.frequency_index = program.frequency_index;
+    info.ecc = program.ecc;
+    info.country = program.country;
+    info.details = program.details;
+  }
+  if (programs_version) {
+    *programs_version = version;
+  }
+  return programs;
+}
+
+bool
+StateReader::wait(uint32_t changes, chrono::milliseconds timeout) const
+{
+  auto deadline = chrono::steady_clock::now() + timeout;
+  while (this->changes() == changes) {
+    auto remaining = deadline - chrono::steady_clock::now();
+    if (remaining <= chrono::nanoseconds::zero()) {
+      return false;
+    }
+    futex_wait(_header->changes, changes, remaining);
+  }
+  return true;
+}
+
+};
@@ -0,0 +1,113 @@
+// -*- C++ -*-
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <oceanus.h>
+#include <seqlock.h>
+
+using namespace std;
+
+namespace Oceanus {
+
+// The radio state in a memory mapped file, typically below /dev/shm,
+// for other processes to read without going through the radio.  The
+// segment starts with a Header holding the current Radio::Snapshot in
+// a SeqLock, followed by a table of up to program_capacity programs
+// guarded by a sequence number of its own.  Readers map the file read
+// only and copy what they need; neither side ever waits for the other.
+//
+// Every update increments the changes counter in the header and wakes
+// the processes waiting for it with a futex.  The segment is replaced
+// atomically when created and marked closed when the exporting process
+// is done with it, so readers know to open it again.
+
+class StateExport
+{
+public:
+  struct Program {
+    char name[48];          // NUL terminated UTF-8
+    char ensemble[48];
+    uint8_t program_type;
+    uint8_t frequency_index;
+    uint8_t ecc;
+    uint8_t country;
+    uint8_t details;        // the four fields above are valid
+    uint8_t reserved[3];
+  };
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t program_capacity;
+    uint64_t length;                        // of the segment
+    atomic<uint32_t> changes;               // the futex word
+    atomic<uint32_t> closed;
+    SeqLock<Radio::Snapshot> state;
+    atomic<uint64_t> programs_sequence;     // odd while the table is written
+    atomic<uint64_t> programs_version;      // Snapshot::programs_version of the table
+    atomic<uint64_t> program_count;         // in the table, at most program_capacity
+  };
+
+  static constexpr char magic[8] = { 'T', '4', 'B', 'S', 'T', 'A', 'T', 'E' };
+  static const uint32_t version = 1;
+
+  StateExport(const string& path, uint32_t program_capacity = 1024);
+  ~StateExport();
+
+  StateExport(const StateExport&) = delete;
+  StateExport& operator=(const StateExport&) = delete;
+
+  void publish(const Radio::Snapshot& snapshot);
+  void publish(const vector<ProgramInfo>& programs, uint64_t programs_version);
+
+private:
+  string _path;
+  Header* _header;
+  size_t _length;
+
+  void changed();
+};
+
+// Read side of a StateExport, in any process
+class StateReader
+{
+public:
+  // Throws runtime_error if there is no intact segment at path
+  StateReader(const string& path);
+  ~StateReader();
+
+  StateReader(const StateReader&) = delete;
+  StateReader& operator=(const StateReader&) = delete;
+
+  // Both throw runtime_error if no consistent copy can be read within
+  // _read_timeout, as happens when the exporting process died while
+  // publishing
+  Radio::Snapshot snapshot() const;
+  vector<ProgramInfo> programs(uint64_t* programs_version = nullptr) const;
+
+  // Wait until the changes counter differs from changes, which should
+  // have been read before the state it was compared with.  Returns
+  // false on timeout.
+  uint32_t changes() const { return _header->changes.load(memory_order_acquire); }
+  bool wait(uint32_t changes, chrono::milliseconds timeout) const;
+
+  // The exporting process has gone, the segment is no longer updated
+  bool closed() const { return _header->closed.load(memory_order_acquire); }
+
+private:
+  static constexpr chrono::milliseconds _read_timeout{100};
+
+  const StateExport::Header* _header;
+  size_t _length;
+
+  template <class F>
+  static void retry(F attempt);
+};
+
+};
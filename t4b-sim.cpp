@@ -0,0 +1,125 @@
+#include <module_simulator.h>
+
+#include <iostream>
+#include <system_error>
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace Oceanus;
+
+// Oceanus T4B simulator on a pseudo terminal.  Radio connects to the
+// slave side of the pty like to a serial port.
+
+class PtySimulator
+{
+public:
+  PtySimulator(const ModuleSimulator::Options& options, const string& link);
+  ~PtySimulator();
+
+  void run();
+
+private:
+  Reactor _reactor;
+  int _signal_fd;
+  string _link;
+  PtyModule _module;
+
+  void handle_signals();
+};
+
+PtySimulator::PtySimulator(const ModuleSimulator::Options& options, const string& link)
+  : _signal_fd(-1),
+    _link(link),
+    _module(_reactor, options)
+{
+  if (_link.length()) {
+    unlink(_link.c_str());
+    if (symlink(_module.slave_name().c_str(), _link.c_str()) == -1) {
+      throw system_error(errno, generic_category(), "Cannot create link " + _link);
+    }
+    cout << _link << " -> ";
+  }
+  cout << _module.slave_name() << endl;
+
+  handle_signals();
+}
+
+PtySimulator::~PtySimulator()
+{
+  if (_link.length()) {
+    unlink(_link.c_str());
+  }
+  _reactor.remove(_signal_fd);
+  close(_signal_fd);
+}
+
+void
+PtySimulator::handle_signals()
+{
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigprocmask(SIG_BLOCK, &signals, nullptr);
+  _signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+  _reactor.add(_signal_fd, EPOLLIN, [this](uint32_t) { _reactor.stop(); });
+}
+
+void
+PtySimulator::run()
+{
+  _reactor.run();
+  cout << "Handled " << _module.requests() << " requests" << endl;
+}
+
+static void
+usage()
+{
+  cerr << "usage: t4b-sim [options]" << endl
+       << "  --link PATH            create PATH as a symlink to the pty slave" << endl
+       << "  --programs N           number of programs in the database" << endl
+       << "  --latency MS           default response latency in milliseconds" << endl
+       << "  --latency COMMAND=MS   latency for one command, e.g. STREAM_GetProgramName=5" << endl
+       << "  --baud RATE            simulated line speed, 0 for unlimited" << endl
+       << "  --noise P              probability of a corrupted or inserted byte" << endl
+       << "  --seed N               seed for the noise generator" << endl;
+  exit(1);
+}
+
+int
+main(int argc, char* argv[])
+{
+  ModuleSimulator::Options options;
+  string link;
+
+  for (int i = 1; i < argc; i++) {
+    string option = argv[i];
+    if (i + 1 >= argc) {
+      usage();
+    }
+    string value = argv[++i];
+    if (option == "--link") {
+      link = value;
+    } else if (option == "--programs") {
+      options.programs = stoul(value);
+    } else if (option == "--latency") {
+      ModuleSimulator::parse_latency(options, value);
+    } else if (option == "--baud") {
+      options.baud_rate = stoul(value);
+    } else if (option == "--noise") {
+      options.noise = stod(value);
+    } else if (option == "--seed") {
+      options.seed = stoul(value);
+    } else {
+      usage();
+    }
+  }
+
+  PtySimulator simulator(options, link);
+  simulator.run();
+}
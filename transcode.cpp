@@ -0,0 +1,135 @@
+#include <transcode.h>
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace Oceanus {
+
+static inline char*
+encode_utf8(uint32_t code_point, char* out)
+{
+  if (code_point < 0x80) {
+    *out++ = code_point;
+  } else if (code_point < 0x800) {
+    *out++ = 0xc0 | code_point >> 6;
+    *out++ = 0x80 | (code_point & 0x3f);
+  } else if (code_point < 0x10000) {
+    *out++ = 0xe0 | code_point >> 12;
+    *out++ = 0x80 | (code_point >> 6 & 0x3f);
+    *out++ = 0x80 | (code_point & 0x3f);
+  } else {
+    *out++ = 0xf0 | code_point >> 18;
+    *out++ = 0x80 | (code_point >> 12 & 0x3f);
+    *out++ = 0x80 | (code_point >> 6 & 0x3f);
+    *out++ = 0x80 | (code_point & 0x3f);
+  }
+  return out;
+}
+
+// Convert a run of ASCII characters, eight or sixteen at a time.
+// Returns the number of UCS-2 characters consumed, which is less than
+// count when a non-ASCII character or U+0000 comes up.
+static inline size_t
+ucs2_ascii_run(const uint8_t* p, size_t count, char*& out)
+{
+  size_t i = 0;
+#if defined(__SSE2__)
+  // As little endian 16 bit lanes, an ASCII character has a zero low
+  // byte (its high byte) and bit 15 clear, and is not zero
+  const __m128i non_ascii = _mm_set1_epi16((short) 0x80ff);
+  const __m128i zero = _mm_setzero_si128();
+  while (count - i >= 8) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 2 * i));
+    __m128i ascii = _mm_cmpeq_epi8(_mm_and_si128(v, non_ascii), zero);
+    __m128i nul = _mm_cmpeq_epi16(v, zero);
+    if (_mm_movemask_epi8(_mm_andnot_si128(nul, ascii)) != 0xffff) {
+      break;
+    }
+    __m128i low = _mm_srli_epi16(v, 8);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(low, low));
+    out += 8;
+    i += 8;
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  const uint8x16_t high_bit = vdupq_n_u8(0x80);
+  while (count - i >= 16) {
+    uint8x16x2_t v = vld2q_u8(p + 2 * i);
+    uint8x16_t nul = vceqzq_u8(vorrq_u8(v.val[0], v.val[1]));
+    if (vmaxvq_u8(vorrq_u8(vorrq_u8(v.val[0], vandq_u8(v.val[1], high_bit)), nul))) {
+      break;
+    }
+    vst1q_u8(reinterpret_cast<uint8_t*>(out), v.val[1]);
+    out += 16;
+    i += 16;
+  }
+#endif
+  return i;
+}
+
+size_t
+ucs2_to_utf8(const uint8_t* p, size_t length, char* out)
+{
+  char* start = out;
+  size_t count = length / 2;
+  size_t i = 0;
+
+  while (i < count) {
+    i += ucs2_ascii_run(p + 2 * i, count - i, out);
+
+    // Scalar until the next block boundary, or to the end
+    size_t end = min(count, i + 8);
+    while (i < end) {
+      uint32_t c = p[2 * i] << 8 | p[2 * i + 1];
+      // Names are padded with U+0000, which ends the text
+      if (!c) {
+        return out - start;
+      }
+      i++;
+      if (c >= 0xd800 && c < 0xe000) {
+        uint32_t low = i < count ? (p[2 * i] << 8 | p[2 * i + 1]) : 0;
+        if (c < 0xdc00 && low >= 0xdc00 && low < 0xe000) {
+          c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+          i++;
+        } else {
+          c = 0xfffd;
+        }
+      }
+      out = encode_utf8(c, out);
+    }
+  }
+  return out - start;
+}
+
+void
+ucs2_to_utf8(const uint8_t* p, size_t length, string& out)
+{
+  out.resize(ucs2_utf8_capacity(length));
+  out.resize(ucs2_to_utf8(p, length, &out[0]));
+}
+
+string
+ucs2_to_utf8(const uint8_t* p, unsigned length)
+{
+  string text;
+  ucs2_to_utf8(p, length, text);
+  return text;
+}
+
+void
+copy_utf8(const string& text, char* buffer, size_t size)
+{
+  size_t length = min(text.size(), size - 1);
+  while (length < text.size() && length > 0 && (text[length] & 0xc0) == 0x80) {
+    length--;
+  }
+  memcpy(buffer, text.data(), length);
+  memset(buffer + length, 0, size - length);
+}
+
+};
@@ -0,0 +1,31 @@
+// -*- C++ -*-
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+namespace Oceanus {
+
+// Conversion of the module's text encodings to UTF-8.  The buffer
+// versions write to caller provided memory of at least the given
+// capacity, never allocate, and return the number of bytes written.
+// The string versions reuse the string's storage.
+
+// UCS-2 big endian, as used for program names and texts.  The text
+// ends at the first U+0000.  Valid surrogate pairs are combined,
+// unpaired surrogates become U+FFFD.
+constexpr size_t ucs2_utf8_capacity(size_t length) { return length / 2 * 3; }
+size_t ucs2_to_utf8(const uint8_t* p, size_t length, char* out);
+void ucs2_to_utf8(const uint8_t* p, size_t length, string& out);
+string ucs2_to_utf8(const uint8_t* p, unsigned length);
+
+// Copy UTF-8 text to a NUL terminated buffer of the given size, which
+// is zero filled behind the text.  Text that does not fit is cut at a
+// character boundary.
+void copy_utf8(const string& text, char* buffer, size_t size);
+
+};
@@ -0,0 +1,199 @@
+#include <transport.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <errno.h>
+#include <unistd.h>
+
+namespace Oceanus {
+
+FdTransport::FdTransport(Reactor& reactor, const string& name)
+  : Transport(reactor, name),
+    _fd(-1),
+    _writable(false),
+    _hung_up(false)
+{
+}
+
+FdTransport::~FdTransport()
+{
+  if (_fd != -1) {
+    _reactor.remove(_fd);
+    close(_fd);
+  }
+}
+
+void
+FdTransport::attach(int fd)
+{
+  _fd = fd;
+  _reactor.add(_fd, EPOLLIN, [this](uint32_t events) { handle_io(events); });
+}
+
+void
+FdTransport::handle_io(uint32_t events)
+{
+  if (events & EPOLLOUT) {
+    _writable = true;
+  }
+  if (events & EPOLLHUP) {
+    _hung_up = true;
+  }
+  if (events & (EPOLLIN | EPOLLERR | EPOLLHUP) && _readable) {
+    _readable();
+  }
+}
+
+size_t
+FdTransport::read(uint8_t* buffer, size_t length)
+{
+  int result = ::read(_fd, buffer, length);
+  if (result == -1) {
+    if (errno == EAGAIN || errno == EINTR) {
+      return 0;
+    }
+    throw system_error(errno, generic_category(), "Error reading from " + _name);
+  }
+  if (result == 0 && _hung_up) {
+    throw runtime_error(_name + " hung up");
+  }
+  return result;
+}
+
+size_t
+FdTransport::write(const uint8_t* buffer, size_t length)
+{
+  int result = ::write(_fd, buffer, length);
+  if (result == -1) {
+    if (errno == EAGAIN || errno == EINTR) {
+      return 0;
+    }
+    throw system_error(errno, generic_category(), "Could not write to " + _name);
+  }
+  return result;
+}
+
+bool
+FdTransport::wait_writable(Reactor::time_point deadline)
+{
+  _writable = false;
+  _reactor.modify(_fd, EPOLLIN | EPOLLOUT);
+  bool writable = _reactor.run_until([&] { return _writable; }, deadline);
+  _reactor.modify(_fd, EPOLLIN);
+  return writable;
+}
+
+SerialTransport::SerialTransport(Reactor& reactor, const string& port)
+  : FdTransport(reactor, "serial port " + port)
+{
+  int fd = open(port.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+  if (fd == -1) {
+    throw invalid_argument((string) "Cannot open serial port: " + port + " - " + strerror(errno));
+  }
+
+  struct termios options;
+
+  cfmakeraw(&options);
+  cfsetispeed(&options, B115200);
+  cfsetospeed(&options, B115200);
+  options.c_lflag = options.c_iflag = options.c_oflag = 0;
+  options.c_cflag = CREAD | CS8 | CLOCAL;
+  options.c_cc[VMIN] = 0;
+  options.c_cc[VTIME] = 0;
+
+  tcsetattr(fd, TCSANOW, &options);
+
+  {
+    int status = TIOCM_RTS;
+    ioctl(fd, TIOCMSET, &status);
+  }
+
+  attach(fd);
+}
+
+PtyTransport::PtyTransport(Reactor& reactor, const string& path)
+  : FdTransport(reactor, "pseudo terminal " + path)
+{
+  int fd = open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+  if (fd == -1) {
+    throw invalid_argument((string) "Cannot open pseudo terminal: " + path + " - " + strerror(errno));
+  }
+
+  struct termios options;
+  tcgetattr(fd, &options);
+  cfmakeraw(&options);
+  tcsetattr(fd, TCSANOW, &options);
+
+  attach(fd);
+}
+
+LoopbackTransport::LoopbackTransport(Reactor& reactor, const string& name)
+  : Transport(reactor, name),
+    _input_offset(0),
+    _timer(0)
+{
+}
+
+LoopbackTransport::~LoopbackTransport()
+{
+  if (_timer) {
+    _reactor.cancel_timer(_timer);
+  }
+}
+
+void
+LoopbackTransport::deliver(const uint8_t* data, size_t length)
+{
+  _input.insert(_input.end(), data, data + length);
+  schedule();
+}
+
+void
+LoopbackTransport::schedule()
+{
+  if (_timer) {
+    return;
+  }
+  _timer = _reactor.add_timer(Reactor::time_point::min(), [this]() {
+    _timer = 0;
+    if (_readable) {
+      _readable();
+    }
+    if (_readable && _input_offset < _input.size()) {
+      schedule();
+    }
+  });
+}
+
+size_t
+LoopbackTransport::read(uint8_t* buffer, size_t length)
+{
+  size_t count = min(length, _input.size() - _input_offset);
+  memcpy(buffer, _input.data() + _input_offset, count);
+  _input_offset += count;
+  if (_input_offset == _input.size()) {
+    _input.clear();
+    _input_offset = 0;
+  }
+  return count;
+}
+
+size_t
+LoopbackTransport::write(const uint8_t* buffer, size_t length)
+{
+  if (_peer) {
+    _peer(buffer, length);
+  }
+  return length;
+}
+
+};
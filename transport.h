@@ -0,0 +1,126 @@
+// -*- C++ -*-
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <reactor.h>
+
+using namespace std;
+
+namespace Oceanus {
+
+// Byte stream between the host and the module.  All member functions
+// are called on the reactor thread.  read() and write() never block:
+// they return the number of bytes transferred, which is 0 if the
+// transport would block, and throw on errors.
+
+class Transport
+{
+public:
+  using readable_handler = function<void()>;
+
+  virtual ~Transport() {}
+
+  Transport(const Transport&) = delete;
+  Transport& operator=(const Transport&) = delete;
+
+  // The handler is invoked whenever read() may return data
+  void on_readable(readable_handler handler) { _readable = handler; }
+
+  virtual size_t read(uint8_t* buffer, size_t length) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t length) = 0;
+
+  // Dispatch reactor events until write() can make progress.  Returns
+  // false if the deadline passed first.
+  virtual bool wait_writable(Reactor::time_point deadline) = 0;
+
+  const string& name() const { return _name; }
+
+protected:
+  Transport(Reactor& reactor, const string& name)
+    : _reactor(reactor),
+      _name(name)
+  {}
+
+  Reactor& _reactor;
+  const string _name;
+  readable_handler _readable;
+};
+
+// Transport over a non-blocking file descriptor registered with the
+// reactor.  The descriptor is closed on destruction.
+
+class FdTransport
+  : public Transport
+{
+public:
+  ~FdTransport();
+
+  size_t read(uint8_t* buffer, size_t length) override;
+  size_t write(const uint8_t* buffer, size_t length) override;
+  bool wait_writable(Reactor::time_point deadline) override;
+
+protected:
+  FdTransport(Reactor& reactor, const string& name);
+
+  void attach(int fd);
+
+private:
+  int _fd;
+  bool _writable;
+  bool _hung_up;
+
+  void handle_io(uint32_t events);
+};
+
+// The module's UART at 115200 baud, 8N1, with RTS asserted
+class SerialTransport
+  : public FdTransport
+{
+public:
+  SerialTransport(Reactor& reactor, const string& port);
+};
+
+// The slave side of a pseudo terminal, for example one created by
+// t4b-sim.  There is no line speed and no modem control.
+class PtyTransport
+  : public FdTransport
+{
+public:
+  PtyTransport(Reactor& reactor, const string& path);
+};
+
+// In-process transport without any system calls.  Bytes written by
+// the host are passed to the peer function synchronously, bytes the
+// peer passes to deliver() become readable from the next reactor
+// iteration.
+
+class LoopbackTransport
+  : public Transport
+{
+public:
+  using peer_function = function<void(const uint8_t* data, size_t length)>;
+
+  LoopbackTransport(Reactor& reactor, const string& name = "loopback");
+  ~LoopbackTransport();
+
+  void set_peer(peer_function peer) { _peer = peer; }
+  void deliver(const uint8_t* data, size_t length);
+
+  size_t read(uint8_t* buffer, size_t length) override;
+  size_t write(const uint8_t* buffer, size_t length) override;
+  bool wait_writable(Reactor::time_point) override { return true; }
+
+private:
+  peer_function _peer;
+  vector<uint8_t> _input;
+  size_t _input_offset;
+  Reactor::timer_id _timer;
+
+  void schedule();
+};
+
+};